@@ -0,0 +1,18 @@
+def can_build(env, platform):
+    return True
+
+
+def get_opts(platform):
+    from SCons.Variables import BoolVariable
+
+    return [
+        BoolVariable(
+            "gdmpt_realtime_checks",
+            "Count heap allocations and module locks on the audio thread, for debug builds",
+            False,
+        ),
+    ]
+
+
+def configure(env):
+    pass
@@ -0,0 +1,27 @@
+#include "register_types.h"
+
+#include "core/object/class_db.h"
+
+#include "audio_stream_gdmpt.h"
+#include "audio_stream_gdmpt_layers.h"
+#include "gdmpt_scanner.h"
+
+using namespace godot;
+
+void initialize_gdmpt_module(ModuleInitializationLevel p_level) {
+	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
+		return;
+	}
+
+	GDREGISTER_CLASS(AudioStreamGDMPT);
+	GDREGISTER_CLASS(AudioStreamGDMPTPlayback);
+	GDREGISTER_CLASS(AudioStreamGDMPTLayers);
+	GDREGISTER_CLASS(AudioStreamGDMPTLayersPlayback);
+	GDREGISTER_CLASS(GDMPTScanner);
+}
+
+void uninitialize_gdmpt_module(ModuleInitializationLevel p_level) {
+	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
+		return;
+	}
+}
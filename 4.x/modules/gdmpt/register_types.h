@@ -0,0 +1,9 @@
+#ifndef GDMPT_REGISTER_TYPES_H
+#define GDMPT_REGISTER_TYPES_H
+
+#include "modules/register_module_types.h"
+
+void initialize_gdmpt_module(ModuleInitializationLevel p_level);
+void uninitialize_gdmpt_module(ModuleInitializationLevel p_level);
+
+#endif
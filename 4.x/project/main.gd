@@ -76,10 +76,8 @@ func _on_pitch_changed(value):
 	player.stream.pitch_factor = value
 	
 func _on_channel_toggled(toggled_on: bool, channel: int):
-	var volume = 0.0
-	if toggled_on:
-		volume = 1.0
-	player.stream.set_channel_volume(channel, volume)
+	# Muted channels are skipped by the mixer, unlike channels at volume 0
+	player.stream.set_channel_mute(channel, not toggled_on)
 	
 func _on_filter_selected(index: int):
 	player.stream.interpolation_filter = INTERP_VALUES[index]
@@ -1,19 +1,87 @@
 #include "audio_stream_gdmpt.h"
 
-#include <godot_cpp/classes/file_access.hpp>
-#include <godot_cpp/core/class_db.hpp>
-#include <godot_cpp/core/error_macros.hpp>
-#include <type_traits>
+#include "module_metadata.h"
+#include "realtime_checks.h"
+#include "tracer.h"
 
-#include <godot_cpp/variant/utility_functions.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <type_traits>
 
 using namespace godot;
 
-// Godot's sampling rate
-// https://docs.godotengine.org/en/4.2/contributing/development/core_and_modules/custom_audiostreams.html
-constexpr double SAMPLING_RATE = 44100.0;
-
 const char *LOOPING_SIGNAL = "looped";
+const char *GOVERNOR_TIER_CHANGED_SIGNAL = "governor_tier_changed";
+const char *JUMP_APPLIED_SIGNAL = "jump_applied";
+const char *RELOADED_SIGNAL = "reloaded";
+
+// Frames rendered by `prepare`, about 93ms
+constexpr int32_t PREPARE_FRAMES = 4096;
+
+// Weight of the latest render in the governor's smoothed load
+constexpr double GOVERNOR_SMOOTHING = 0.1;
+// Callbacks over budget before stepping the quality down
+constexpr int32_t GOVERNOR_STEP_DOWN_CALLBACKS = 8;
+// Callbacks under `GOVERNOR_STEP_UP_RATIO` of the budget before stepping the
+// quality back up. Much longer than stepping down to avoid oscillating.
+constexpr int32_t GOVERNOR_STEP_UP_CALLBACKS = 512;
+constexpr double GOVERNOR_STEP_UP_RATIO = 0.5;
+
+// Chunk sizes used while a jump is pending. On the row before the boundary,
+// at most `JUMP_FINE_CHUNK_FRAMES` of the next row are heard before the jump.
+// The coarse chunk is shorter than the shortest possible row.
+constexpr int32_t JUMP_FINE_CHUNK_FRAMES = 8;
+constexpr int32_t JUMP_COARSE_CHUNK_FRAMES = 128;
+// Used when the rows per beat cannot be derived
+constexpr int32_t DEFAULT_ROWS_PER_BEAT = 4;
+
+// Render LOD: the reduced rate and how far audibility has to rise above a
+// threshold before going back up, to not flip between levels. Suspended
+// playbacks still render at the suspended divider and minimal quality to keep
+// the song going, and output silence.
+constexpr int32_t LOD_REDUCED_RATE_DIVIDER = 2;
+constexpr int32_t LOD_SUSPENDED_RATE_DIVIDER = 4;
+constexpr double LOD_HYSTERESIS = 1.5;
+// Rate divider at which the module is advanced while it is silent with nothing
+// playing. The output stays at the rate of the playback and is silence.
+constexpr int32_t IDLE_RATE_DIVIDER = 4;
+
+// Format of `save_playback_state`, increased when keys change meaning
+constexpr int32_t PLAYBACK_STATE_VERSION = 1;
+
+// Range of `play_note` pitches, C-0 to B-9
+constexpr int32_t MIN_NOTE = 0;
+constexpr int32_t MAX_NOTE = 119;
+
+// Number of beats over which the tempo lock catches up on drift
+constexpr double TEMPO_LOCK_CATCH_UP_BEATS = 0.5;
+// Largest change of the tempo factor used to correct drift
+constexpr double TEMPO_LOCK_MAX_CORRECTION = 0.05;
+// Smaller changes of the tempo factor are not applied
+constexpr double TEMPO_LOCK_FACTOR_EPSILON = 1e-6;
+
+// libopenmpt keeps the finetune of a channel in steps of 1/32768 semitone.
+// The lowest steps of a note's finetune hold its voice, which a note started
+// by the pattern on the same channel does not have.
+constexpr int32_t FINETUNE_STEPS = 32768;
+constexpr int32_t VOICE_TAG_STEPS = 64;
+
+static double tag_finetune(double finetune, int32_t voice) {
+	auto steps = std::min(static_cast<int32_t>(finetune * FINETUNE_STEPS) / VOICE_TAG_STEPS,
+			FINETUNE_STEPS / VOICE_TAG_STEPS - 1);
+	return static_cast<double>(steps * VOICE_TAG_STEPS + voice + 1) / FINETUNE_STEPS;
+}
+
+// Derives the rows per beat from the estimated BPM, assuming classic tempo
+// mode like `publish_position`
+static int32_t get_rows_per_beat(const ModulePosition &position) {
+	if (position.speed <= 0 || position.estimated_bpm <= 0.0) {
+		return DEFAULT_ROWS_PER_BEAT;
+	}
+	auto rows = std::lround(position.tempo * 24.0 / (position.speed * position.estimated_bpm));
+	return rows >= 1 ? static_cast<int32_t>(rows) : DEFAULT_ROWS_PER_BEAT;
+}
 
 struct OpenMPTStringDeleter {
 	void operator()(const char *p) { openmpt_free_string(p); }
@@ -22,24 +90,28 @@ struct OpenMPTStringDeleter {
 using OpenMPTString =
 		std::unique_ptr<const char, OpenMPTStringDeleter>;
 
-#define OPENMPT_ERR_FAIL_V_EDMSG(obj, m_retval)   \
-	auto err_msg = obj->pop_last_openmpt_error(); \
-	ERR_FAIL_COND_V_EDMSG(err_msg.has_value(), m_retval, err_msg.value())
-
 Ref<AudioStreamGDMPT> AudioStreamGDMPT::load_from_buffer(
 		const PackedByteArray &buffer) {
+	GDMPT_TRACE_SCOPE("load_from_buffer");
+
+	// libopenmpt copies what it needs, nothing keeps `buffer`
+	return create_from_data(buffer, -1);
+}
+
+Ref<AudioStreamGDMPT> AudioStreamGDMPT::create_from_data(const PackedByteArray &data, int32_t subsong) {
 	Ref<AudioStreamGDMPT> stream;
 	stream.instantiate();
 
 	int error;
 
+	TraceScope parse_trace("load_parse");
 	// Returns a pointer that *must* be freed with `openmpt_module_ext_destroy`.
 	// Code below is ensuring this using a `std::unique_ptr` with a custom
 	// deleter. Presumably copies the buffer internally so we don't need to
-	// store/copy `buffer`.
+	// store/copy `data`.
 	auto ptr = openmpt_module_ext_create_from_memory(
-			buffer.ptr(),
-			static_cast<std::size_t>(buffer.size()),
+			data.ptr(),
+			static_cast<std::size_t>(data.size()),
 			openmpt_log_func_silent,
 			nullptr,
 			AudioStreamGDMPT::error_func,
@@ -59,7 +131,17 @@ Ref<AudioStreamGDMPT> AudioStreamGDMPT::load_from_buffer(
 		ERR_FAIL_V_EDMSG(nullptr, msg);
 	}
 	auto module = ModuleExtUniquePtr(ptr);
+	parse_trace.end();
+
+	{
+		// libopenmpt has every loader compiled in, the build can still restrict
+		// the formats
+		auto format = get_module_metadata(reinterpret_cast<openmpt_module *>(ptr), "type");
+		ERR_FAIL_COND_V_EDMSG(!is_format_enabled(format), nullptr,
+				"Module format '" + String::utf8(format.c_str()) + "' is not enabled in this build.");
+	}
 
+	TraceScope interfaces_trace("load_interfaces");
 	auto interactive =
 			std::make_unique<openmpt_module_ext_interface_interactive>();
 	if (interactive == nullptr) {
@@ -77,24 +159,234 @@ Ref<AudioStreamGDMPT> AudioStreamGDMPT::load_from_buffer(
 		ERR_FAIL_V_EDMSG(nullptr, "Unable to get interface from module_ext");
 	}
 
-	stream->module.set_pointers(std::move(module), std::move(interactive));
+	// Only used for the finetune of `play_note`, older libopenmpt versions do
+	// not have it
+	auto interactive2 =
+			std::make_unique<openmpt_module_ext_interface_interactive2>();
+	error = openmpt_module_ext_get_interface(
+			module.get(),
+			LIBOPENMPT_EXT_C_INTERFACE_INTERACTIVE2,
+			interactive2.get(),
+			sizeof(openmpt_module_ext_interface_interactive2));
+	if (error == 0) {
+		interactive2.reset();
+	}
+
+	// Only used to restore fractional tempos, older libopenmpt versions do not
+	// have it
+	auto interactive3 =
+			std::make_unique<openmpt_module_ext_interface_interactive3>();
+	error = openmpt_module_ext_get_interface(
+			module.get(),
+			LIBOPENMPT_EXT_C_INTERFACE_INTERACTIVE3,
+			interactive3.get(),
+			sizeof(openmpt_module_ext_interface_interactive3));
+	if (error == 0) {
+		interactive3.reset();
+	}
+
+	stream->module.set_pointers(std::move(module), std::move(interactive), std::move(interactive2),
+			std::move(interactive3));
+	// Handed over to the render thread once loaded, never shared
+	stream->module.set_locking_enabled(false);
+	stream->module_loaded.store(true, std::memory_order_release);
+	interfaces_trace.end();
+
+	{
+		GDMPT_TRACE_SCOPE("load_subsongs");
+		if (subsong < 0) {
+			subsong = std::max(stream->module.get_selected_subsong(), 0);
+		}
+		stream->subsongs = stream->module.read_subsong_metadata(subsong);
+		stream->subsong = subsong;
+		OPENMPT_ERR_FAIL_V_EDMSG(stream, nullptr);
+	}
+	{
+		GDMPT_TRACE_SCOPE("load_structure");
+		stream->read_structure();
+		OPENMPT_ERR_FAIL_V_EDMSG(stream, nullptr);
+	}
+
+	int32_t filter = 0;
+	stream->module.get_interpolation_filter(&filter);
+	stream->interpolation_filter = filter;
 
-	for (int32_t i = 0; i < stream->get_num_channels(); i++) {
-		stream->volume_settings.push_back(stream->get_channel_volume(i));
+	auto num_channels = stream->get_num_channels();
+	ERR_FAIL_COND_V_EDMSG(num_channels > MAX_CHANNELS, nullptr,
+			"Modules with more than " + String::num_int64(MAX_CHANNELS) + " channels are not supported.");
+	for (int32_t i = 0; i < num_channels; i++) {
+		stream->volume_settings[i] = stream->module.get_channel_volume(i);
 	}
+	stream->channel_mutes.resize(num_channels, false);
+	stream->channel_solos.resize(num_channels, false);
+	// A reload resizes it on the render thread
+	stream->mute_status.reserve(MAX_CHANNELS);
+	stream->mute_status.resize(num_channels, false);
 
 	return stream;
 }
 
+void AudioStreamGDMPT::read_structure() {
+	for (int32_t order = 0; order < module.get_num_orders(); order++) {
+		order_patterns.push_back(module.get_order_pattern(order));
+	}
+
+	for (int32_t pattern = 0; pattern < module.get_num_patterns(); pattern++) {
+		pattern_num_rows.push_back(module.get_pattern_num_rows(pattern));
+	}
+	pattern_data.resize(pattern_num_rows.size());
+
+	// `play_note` plays samples if the module has no instruments
+	auto num_instruments = module.get_num_instruments();
+	if (num_instruments > 0) {
+		for (int32_t i = 0; i < num_instruments; i++) {
+			instrument_names.push_back(String::utf8(module.get_instrument_name(i).c_str()));
+		}
+	} else {
+		for (int32_t i = 0; i < module.get_num_samples(); i++) {
+			instrument_names.push_back(String::utf8(module.get_sample_name(i).c_str()));
+		}
+	}
+}
+
 Ref<AudioStreamGDMPT> AudioStreamGDMPT::load_from_file(const String &path) {
+	TraceScope read_trace("load_read_file");
 	auto file_data = FileAccess::get_file_as_bytes(path);
+	read_trace.end();
 	ERR_FAIL_COND_V_EDMSG(
 			file_data.is_empty(), nullptr, "Cannot open file '" + path + "'.");
-	auto stream = load_from_buffer(file_data);
+	// The bytes are released, `instantiate_subsong` reads the file again
+	auto stream = create_from_data(file_data, -1);
+	ERR_FAIL_NULL_V(stream, nullptr);
 	stream->filename = path;
 	return stream;
 }
 
+void AudioStreamGDMPT::reload_from_buffer(const PackedByteArray &buffer) {
+	ERR_FAIL_COND(!has_module());
+	ERR_FAIL_COND_EDMSG(buffer.is_empty(), "Cannot reload from an empty buffer.");
+	ERR_FAIL_COND_EDMSG(is_reloading(), "A reload is already in progress.");
+
+	reload_buffer = buffer;
+	reload_path = String();
+	reload_state = RELOAD_PENDING;
+	reload_task_id = WorkerThreadPool::get_singleton()->add_task(
+			callable_mp(this, &AudioStreamGDMPT::parse_reloaded),
+			true,
+			"AudioStreamGDMPT::reload");
+	// `finish_reload` runs there, even if nothing plays the stream yet
+	connect_render_events();
+}
+
+void AudioStreamGDMPT::reload_from_file(const String &path) {
+	ERR_FAIL_COND(!has_module());
+	ERR_FAIL_COND_EDMSG(is_reloading(), "A reload is already in progress.");
+
+	// The worker reads the file
+	reload_buffer = PackedByteArray();
+	reload_path = path;
+	reload_state = RELOAD_PENDING;
+	reload_task_id = WorkerThreadPool::get_singleton()->add_task(
+			callable_mp(this, &AudioStreamGDMPT::parse_reloaded),
+			true,
+			"AudioStreamGDMPT::reload");
+	connect_render_events();
+}
+
+bool AudioStreamGDMPT::is_reloading() const {
+	return reload_state != RELOAD_NONE;
+}
+
+bool AudioStreamGDMPT::has_module() const {
+	return module_loaded.load(std::memory_order_acquire);
+}
+
+bool AudioStreamGDMPT::try_claim_render() {
+	if (render_claimed.exchange(true, std::memory_order_acquire)) {
+		return false;
+	}
+	// The module's mutex is disabled, the claim is what protects it
+	module.set_owned_by_thread(true);
+	return true;
+}
+
+void AudioStreamGDMPT::release_render() {
+	module.set_owned_by_thread(false);
+	render_claimed.store(false, std::memory_order_release);
+}
+
+Ref<AudioStreamGDMPT> AudioStreamGDMPT::instantiate_subsong(int32_t p_subsong, const PackedByteArray &buffer) const {
+	ERR_FAIL_COND_V(subsongs.empty(), nullptr);
+	ERR_FAIL_INDEX_V(p_subsong, get_subsong_count(), nullptr);
+
+	auto source = buffer;
+	if (source.is_empty()) {
+		ERR_FAIL_COND_V_EDMSG(filename.is_empty(), nullptr,
+				"Streams loaded from a buffer need the buffer to instantiate a subsong.");
+		source = FileAccess::get_file_as_bytes(filename);
+		ERR_FAIL_COND_V_EDMSG(source.is_empty(), nullptr, "Cannot open file '" + filename + "'.");
+	}
+	auto stream = create_from_data(source, p_subsong);
+	ERR_FAIL_NULL_V(stream, nullptr);
+	stream->filename = buffer.is_empty() ? filename : String();
+	stream->loop = loop;
+	return stream;
+}
+
+void AudioStreamGDMPT::set_tracing_enabled(bool enable) {
+	Tracer::set_enabled(enable);
+}
+
+bool AudioStreamGDMPT::is_tracing_enabled() {
+	return Tracer::is_enabled();
+}
+
+Error AudioStreamGDMPT::save_trace(const String &path) {
+	auto file = FileAccess::open(path, FileAccess::WRITE);
+	ERR_FAIL_NULL_V_EDMSG(file, ERR_FILE_CANT_WRITE, "Cannot open file '" + path + "'.");
+
+	file->store_string(String::utf8(Tracer::to_chrome_json().c_str()));
+
+	auto dropped = Tracer::get_dropped_thread_count();
+	if (dropped > 0) {
+		WARN_PRINT("Dropped the events of " + String::num_int64(static_cast<int64_t>(dropped)) +
+				" threads, more threads recorded than the tracer has buffers for.");
+	}
+	return OK;
+}
+
+Dictionary AudioStreamGDMPT::get_realtime_violations() {
+	uint64_t callbacks;
+	auto totals = RealtimeChecks::get_totals(callbacks);
+
+	Dictionary result;
+	result["enabled"] = RealtimeChecks::is_enabled();
+	result["callbacks"] = static_cast<int64_t>(callbacks);
+	result["allocations"] = static_cast<int64_t>(totals.allocations);
+	result["lock_acquisitions"] = static_cast<int64_t>(totals.lock_acquisitions);
+	return result;
+}
+
+void AudioStreamGDMPT::prepare(double from_pos) {
+	ERR_FAIL_COND(!has_module());
+	// The worker would render the module at the same time as the playback
+	ERR_FAIL_COND_EDMSG(active_playbacks.load(std::memory_order_acquire) > 0,
+			"Cannot prepare a stream while it is playing.");
+
+	wait_for_prepare();
+
+	prepared_position = from_pos;
+	prepare_state = PREPARE_PENDING;
+	prepare_task_id = WorkerThreadPool::get_singleton()->add_task(
+			callable_mp(this, &AudioStreamGDMPT::render_prepared),
+			true,
+			"AudioStreamGDMPT::prepare");
+}
+
+bool AudioStreamGDMPT::is_prepared() const {
+	return prepare_state == PREPARE_READY;
+}
+
 String AudioStreamGDMPT::get_filename() const {
 	return filename;
 }
@@ -108,92 +400,515 @@ bool AudioStreamGDMPT::get_loop() const {
 }
 
 void AudioStreamGDMPT::set_tempo_factor(double factor) {
-	ERR_FAIL_COND(module.is_null());
+	ERR_FAIL_COND(!has_module());
 
-	module.set_tempo_factor(factor);
-	OPENMPT_ERR_FAIL_V_EDMSG(this, void());
+	tempo_factor.store(factor, std::memory_order_relaxed);
+	request_changes(PENDING_TEMPO_FACTOR);
 }
 
 double AudioStreamGDMPT::get_tempo_factor() const {
-	// This gets called by Godot to check for the default value
-	if (module.is_null()) {
-		return 1.0;
-	}
+	// The factor set, not the one applied by the tempo lock
+	return tempo_factor.load(std::memory_order_relaxed);
+}
+
+void AudioStreamGDMPT::set_tempo_lock_bpm(double bpm) {
+	ERR_FAIL_COND(bpm < 0.0);
+
+	// Disabling the lock restores `tempo_factor` on the next mix
+	tempo_lock_reset.store(true, std::memory_order_relaxed);
+	tempo_lock_bpm.store(bpm, std::memory_order_release);
+}
+
+double AudioStreamGDMPT::get_tempo_lock_bpm() const {
+	return tempo_lock_bpm.load(std::memory_order_relaxed);
+}
 
-	auto tempo_factor = module.get_tempo_factor();
-	OPENMPT_ERR_FAIL_V_EDMSG(this, 0.0);
-	return tempo_factor;
+double AudioStreamGDMPT::get_tempo_lock_drift() const {
+	return tempo_lock_drift.load(std::memory_order_relaxed);
 }
 
 void AudioStreamGDMPT::set_pitch_factor(double factor) {
-	ERR_FAIL_COND(module.is_null());
+	ERR_FAIL_COND(!has_module());
 
-	module.set_pitch_factor(factor);
-	OPENMPT_ERR_FAIL_V_EDMSG(this, void());
+	pitch_factor.store(factor, std::memory_order_relaxed);
+	request_changes(PENDING_PITCH_FACTOR);
 }
 
 double AudioStreamGDMPT::get_pitch_factor() const {
-	// Default value
-	if (module.is_null()) {
-		return 1.0;
-	}
-
-	auto pitch_factor = module.get_pitch_factor();
-	OPENMPT_ERR_FAIL_V_EDMSG(this, 0.0);
-	return pitch_factor;
+	return pitch_factor.load(std::memory_order_relaxed);
 }
 
 void AudioStreamGDMPT::set_interpolation_filter(InterpolationFilter filter) {
-	ERR_FAIL_COND(module.is_null());
+	ERR_FAIL_COND(!has_module());
 
-	module.set_interpolation_filter(filter);
-	OPENMPT_ERR_FAIL_V_EDMSG(this, void());
+	interpolation_filter = filter;
+	request_changes(PENDING_RENDER_QUALITY);
 }
 
 AudioStreamGDMPT::InterpolationFilter AudioStreamGDMPT::get_interpolation_filter() const {
-	// Default value
-	if (module.is_null()) {
-		return InterpolationFilter::DEFAULT_INTERPOLATION;
+	// Returns the requested filter, not the one lowered by the governor
+	return static_cast<InterpolationFilter>(interpolation_filter.load());
+}
+
+int32_t AudioStreamGDMPT::get_num_orders() const {
+	return static_cast<int32_t>(order_patterns.size());
+}
+
+int32_t AudioStreamGDMPT::get_num_patterns() const {
+	return static_cast<int32_t>(pattern_num_rows.size());
+}
+
+int32_t AudioStreamGDMPT::get_order_pattern(int32_t order) const {
+	ERR_FAIL_INDEX_V(order, get_num_orders(), 0);
+
+	return order_patterns[order];
+}
+
+int32_t AudioStreamGDMPT::get_pattern_num_rows(int32_t pattern) const {
+	// Orders can hold separator and end markers instead of a pattern
+	if (pattern < 0 || pattern >= get_num_patterns()) {
+		return 0;
+	}
+	return pattern_num_rows[pattern];
+}
+
+PackedByteArray AudioStreamGDMPT::get_pattern_data(int32_t pattern) const {
+	ERR_FAIL_INDEX_V(pattern, get_num_patterns(), PackedByteArray());
+
+	auto &commands = pattern_data[pattern];
+	auto num_rows = pattern_num_rows[pattern];
+	if (!commands.is_empty() || num_rows == 0) {
+		return commands;
+	}
+
+	GDMPT_TRACE_SCOPE("export_pattern");
+	// Keeps the render thread from swapping in a reloaded module meanwhile
+	auto readers = module_readers.load(std::memory_order_relaxed);
+	do {
+		ERR_FAIL_COND_V_EDMSG(readers < 0, PackedByteArray(),
+				"Pattern data is not available until the reload finishes.");
+	} while (!module_readers.compare_exchange_weak(readers, readers + 1, std::memory_order_acquire));
+
+	// Swapped already, but the tables still describe the old module
+	if (reload_state.load(std::memory_order_acquire) != RELOAD_SWAPPED) {
+		auto num_channels = module.get_num_channels();
+		commands.resize(static_cast<int64_t>(num_rows) * num_channels * PATTERN_COMMAND_COUNT);
+		module.get_pattern_commands(pattern, num_rows, num_channels, commands.ptrw());
 	}
+	module_readers.fetch_sub(1, std::memory_order_release);
+
+	ERR_FAIL_COND_V_EDMSG(commands.is_empty(), PackedByteArray(),
+			"Pattern data is not available until the reload finishes.");
+	return commands;
+}
+
+Vector3i AudioStreamGDMPT::get_current_position() const {
+	auto snapshot = position_snapshot.load(std::memory_order_acquire);
+	return Vector3i(snapshot.order, snapshot.row, snapshot.tick);
+}
+
+void AudioStreamGDMPT::set_governor_enabled(bool enable) {
+	governor_enabled = enable;
+}
+
+bool AudioStreamGDMPT::get_governor_enabled() const {
+	return governor_enabled;
+}
+
+void AudioStreamGDMPT::set_governor_budget(double budget) {
+	governor_budget = budget;
+}
+
+double AudioStreamGDMPT::get_governor_budget() const {
+	return governor_budget;
+}
+
+void AudioStreamGDMPT::set_lod_reduced_audibility(double audibility) {
+	lod_reduced_audibility = audibility;
+}
+
+double AudioStreamGDMPT::get_lod_reduced_audibility() const {
+	return lod_reduced_audibility;
+}
+
+void AudioStreamGDMPT::set_lod_suspended_audibility(double audibility) {
+	lod_suspended_audibility = audibility;
+}
+
+double AudioStreamGDMPT::get_lod_suspended_audibility() const {
+	return lod_suspended_audibility;
+}
 
-	int32_t value;
-	module.get_interpolation_filter(&value);
-	OPENMPT_ERR_FAIL_V_EDMSG(this, InterpolationFilter::DEFAULT_INTERPOLATION);
-	return static_cast<InterpolationFilter>(value);
+AudioStreamGDMPT::GovernorTier AudioStreamGDMPT::get_governor_tier() const {
+	return static_cast<GovernorTier>(governor_tier.load());
 }
 
 int32_t AudioStreamGDMPT::get_num_channels() const {
-	ERR_FAIL_COND_V(module.is_null(), 0);
+	ERR_FAIL_COND_V(subsongs.empty(), 0);
+
+	return subsongs[subsong.load(std::memory_order_relaxed)].num_channels;
+}
+
+void AudioStreamGDMPT::set_subsong(int32_t p_subsong) {
+	ERR_FAIL_INDEX(p_subsong, get_subsong_count());
 
-	auto num_channels = module.get_num_channels();
-	OPENMPT_ERR_FAIL_V_EDMSG(this, 0);
-	return num_channels;
+	subsong.store(p_subsong, std::memory_order_relaxed);
+	request_changes(PENDING_SUBSONG);
+	invalidate_position_history();
+}
+
+int32_t AudioStreamGDMPT::get_subsong() const {
+	return subsong.load(std::memory_order_relaxed);
+}
+
+int32_t AudioStreamGDMPT::get_subsong_count() const {
+	return static_cast<int32_t>(subsongs.size());
+}
+
+Dictionary AudioStreamGDMPT::get_subsong_info(int32_t p_subsong) const {
+	ERR_FAIL_INDEX_V(p_subsong, get_subsong_count(), Dictionary());
+
+	const auto &metadata = subsongs[p_subsong];
+	Dictionary result;
+	result["name"] = String::utf8(metadata.name.c_str());
+	result["duration"] = metadata.duration_seconds;
+	result["start_order"] = metadata.start_order;
+	result["start_row"] = metadata.start_row;
+	result["channels"] = metadata.num_channels;
+	result["speed"] = metadata.initial_speed;
+	result["tempo"] = metadata.initial_tempo;
+	result["bpm"] = metadata.initial_bpm;
+	return result;
 }
 
 void AudioStreamGDMPT::set_channel_volume(int32_t channel, double volume) {
-	ERR_FAIL_COND(module.is_null());
+	ERR_FAIL_INDEX(channel, static_cast<int32_t>(channel_mutes.size()));
 
-	module.set_channel_volume(channel, volume);
-	OPENMPT_ERR_FAIL_V_EDMSG(this, void());
-	volume_settings[channel] = volume;
+	volume_settings[channel].store(volume, std::memory_order_relaxed);
+	request_changes(PENDING_CHANNEL_VOLUMES);
 }
 
 double AudioStreamGDMPT::get_channel_volume(int32_t channel) const {
-	ERR_FAIL_COND_V(module.is_null(), 0.0);
+	ERR_FAIL_INDEX_V(channel, static_cast<int32_t>(channel_mutes.size()), 0.0);
+
+	return volume_settings[channel].load(std::memory_order_relaxed);
+}
 
-	auto volume = module.get_channel_volume(channel);
-	OPENMPT_ERR_FAIL_V_EDMSG(this, 0.0);
-	return volume;
+int64_t AudioStreamGDMPT::queue_jump(int32_t order, int32_t row, JumpBoundary boundary) {
+	ERR_FAIL_COND_V(!has_module(), -1);
+	ERR_FAIL_INDEX_V(order, get_num_orders(), -1);
+	ERR_FAIL_INDEX_V(row, get_pattern_num_rows(get_order_pattern(order)), -1);
+	ERR_FAIL_COND_V_EDMSG(queued_jump_count.load(std::memory_order_acquire) >= MAX_QUEUED_JUMPS, -1,
+			"Cannot queue more than " + String::num_int64(MAX_QUEUED_JUMPS) + " jumps.");
+
+	JumpCommand command;
+	command.type = JumpCommand::QUEUE;
+	command.id = next_jump_id++;
+	command.order = order;
+	command.row = row;
+	command.boundary = boundary;
+	ERR_FAIL_COND_V_EDMSG(!jump_commands.push(command), -1, "Too many jump commands are waiting to be processed.");
+
+	queued_jump_count.fetch_add(1, std::memory_order_relaxed);
+	return command.id;
+}
+
+void AudioStreamGDMPT::cancel_jump(int64_t id) {
+	JumpCommand command;
+	command.type = JumpCommand::CANCEL;
+	command.id = id;
+	ERR_FAIL_COND_EDMSG(!jump_commands.push(command), "Too many jump commands are waiting to be processed.");
+}
+
+void AudioStreamGDMPT::cancel_all_jumps() {
+	JumpCommand command;
+	command.type = JumpCommand::CANCEL_ALL;
+	ERR_FAIL_COND_EDMSG(!jump_commands.push(command), "Too many jump commands are waiting to be processed.");
+}
+
+int32_t AudioStreamGDMPT::get_queued_jump_count() const {
+	return queued_jump_count.load(std::memory_order_acquire);
+}
+
+int64_t AudioStreamGDMPT::play_note(int32_t instrument, double pitch, double volume, double panning) {
+	ERR_FAIL_COND_V(!has_module(), -1);
+	ERR_FAIL_INDEX_V(instrument, get_num_instruments(), -1);
+
+	auto note = static_cast<int32_t>(std::floor(pitch));
+
+	NoteCommand command;
+	command.type = NoteCommand::PLAY;
+	command.instrument = instrument;
+	command.note = std::clamp(note, MIN_NOTE, MAX_NOTE);
+	command.finetune = note >= MIN_NOTE && note <= MAX_NOTE ? pitch - note : 0.0;
+	command.volume = std::clamp(volume, 0.0, 1.0);
+	command.panning = std::clamp(panning, -1.0, 1.0);
+	return send_note_command(command);
+}
+
+void AudioStreamGDMPT::stop_note(int64_t id) {
+	// -1 is returned when `play_note` fails and free voices have id 0
+	if (id <= 0) {
+		return;
+	}
+
+	NoteCommand command;
+	command.type = NoteCommand::STOP;
+	command.id = id;
+	send_note_command(command);
+}
+
+int32_t AudioStreamGDMPT::get_num_instruments() const {
+	return static_cast<int32_t>(instrument_names.size());
+}
+
+String AudioStreamGDMPT::get_instrument_name(int32_t instrument) const {
+	ERR_FAIL_INDEX_V(instrument, get_num_instruments(), String());
+
+	return instrument_names[instrument];
+}
+
+int64_t AudioStreamGDMPT::send_note_command(NoteCommand &command) {
+	ERR_FAIL_COND_V_EDMSG(queued_note_count.load(std::memory_order_acquire) >= MAX_QUEUED_NOTES, -1,
+			"Cannot queue more than " + String::num_int64(MAX_QUEUED_NOTES) + " notes.");
+
+	// Without a rendered block the note is applied by the next mix
+	auto count = position_history.size();
+	PositionStamp latest;
+	if (count > 0 && position_history.read(count - 1, latest)) {
+		auto audio_server = AudioServer::get_singleton();
+		double delay = std::clamp(audio_server->get_time_since_last_mix(), 0.0, audio_server->get_output_latency());
+		command.frame = latest.frames + static_cast<uint64_t>(delay * SAMPLING_RATE);
+	}
+	if (command.type == NoteCommand::PLAY) {
+		command.id = next_note_id++;
+	}
+	ERR_FAIL_COND_V_EDMSG(!note_commands.push(command), -1, "Too many note commands are waiting to be processed.");
+
+	queued_note_count.fetch_add(1, std::memory_order_relaxed);
+	return command.id;
+}
+
+Vector3i AudioStreamGDMPT::get_audible_position() const {
+	PositionStamp stamp;
+	double seconds;
+	if (!find_audible_position(stamp, seconds)) {
+		return get_current_position();
+	}
+	return Vector3i(stamp.order, stamp.row, stamp.tick);
+}
+
+Dictionary AudioStreamGDMPT::save_playback_state() const {
+	ERR_FAIL_COND_V(!has_module(), Dictionary());
+
+	PositionStamp stamp;
+	double seconds;
+	// Set where nothing was rendered since a seek, which gives no row
+	double seek_seconds = -1.0;
+	if (!find_audible_position(stamp, seconds)) {
+		if (sent_restore_generation == position_generation.load(std::memory_order_relaxed)) {
+			// The last restore was not rendered yet
+			stamp.order = sent_restore.order;
+			stamp.row = static_cast<int16_t>(sent_restore.row);
+			stamp.speed = sent_restore.speed;
+			stamp.tempo = sent_restore.tempo;
+			stamp.global_volume = sent_restore.global_volume;
+			stamp.loops = sent_restore.loops;
+			seek_seconds = sent_restore.seconds;
+		} else if (sent_seek_generation == position_generation.load(std::memory_order_relaxed)) {
+			// The last seek was not rendered yet
+			seek_seconds = seek_position.load(std::memory_order_relaxed);
+		} else {
+			// Nothing was rendered since the start or a seek
+			const auto &metadata = subsongs[get_subsong()];
+			stamp.order = metadata.start_order;
+			stamp.row = static_cast<int16_t>(metadata.start_row);
+			stamp.speed = metadata.initial_speed;
+			stamp.tempo = metadata.initial_tempo;
+		}
+	}
+
+	PackedFloat64Array volumes;
+	PackedByteArray mutes;
+	PackedByteArray solos;
+	for (int32_t i = 0; i < static_cast<int32_t>(channel_mutes.size()); i++) {
+		volumes.push_back(volume_settings[i].load(std::memory_order_relaxed));
+		mutes.push_back(channel_mutes[i] ? 1 : 0);
+		solos.push_back(channel_solos[i] ? 1 : 0);
+	}
+
+	Dictionary state;
+	state["version"] = PLAYBACK_STATE_VERSION;
+	state["subsong"] = get_subsong();
+	state["order"] = stamp.order;
+	state["row"] = static_cast<int32_t>(stamp.row);
+	state["tick"] = static_cast<int32_t>(stamp.tick);
+	state["speed"] = stamp.speed;
+	state["tempo"] = stamp.tempo;
+	state["global_volume"] = stamp.global_volume;
+	state["loops"] = stamp.loops;
+	if (seek_seconds >= 0.0) {
+		state["seconds"] = seek_seconds;
+	}
+	state["loop"] = loop;
+	state["tempo_factor"] = get_tempo_factor();
+	state["tempo_lock_bpm"] = get_tempo_lock_bpm();
+	state["pitch_factor"] = get_pitch_factor();
+	state["interpolation_filter"] = static_cast<int32_t>(get_interpolation_filter());
+	state["channel_volumes"] = volumes;
+	state["channel_mutes"] = mutes;
+	state["channel_solos"] = solos;
+	return state;
+}
+
+void AudioStreamGDMPT::restore_playback_state(const Dictionary &state) {
+	ERR_FAIL_COND(!has_module());
+	ERR_FAIL_COND_EDMSG(static_cast<int64_t>(state.get("version", 0)) != PLAYBACK_STATE_VERSION,
+			"Unsupported playback state version.");
+
+	auto p_subsong = static_cast<int32_t>(state.get("subsong", 0));
+	ERR_FAIL_INDEX(p_subsong, get_subsong_count());
+
+	StateRestore restore;
+	restore.order = static_cast<int32_t>(state.get("order", 0));
+	restore.row = static_cast<int32_t>(state.get("row", 0));
+	ERR_FAIL_INDEX(restore.order, get_num_orders());
+	ERR_FAIL_INDEX(restore.row, get_pattern_num_rows(get_order_pattern(restore.order)));
+	restore.speed = static_cast<int32_t>(state.get("speed", 0));
+	restore.tempo = state.get("tempo", 0.0);
+	restore.global_volume = state.get("global_volume", 1.0);
+	restore.loops = static_cast<int32_t>(state.get("loops", 0));
+	restore.seconds = state.get("seconds", -1.0);
+
+	// Sent before the position, which the render thread applies after them.
+	// Selecting the subsong seeks to its start.
+	if (p_subsong != get_subsong()) {
+		set_subsong(p_subsong);
+	}
+	set_loop(state.get("loop", loop));
+	set_tempo_factor(state.get("tempo_factor", get_tempo_factor()));
+	set_tempo_lock_bpm(state.get("tempo_lock_bpm", get_tempo_lock_bpm()));
+	set_pitch_factor(state.get("pitch_factor", get_pitch_factor()));
+	set_interpolation_filter(static_cast<InterpolationFilter>(
+			static_cast<int32_t>(state.get("interpolation_filter", static_cast<int32_t>(get_interpolation_filter())))));
+
+	// Channels the module does not have are ignored
+	PackedFloat64Array volumes = state.get("channel_volumes", PackedFloat64Array());
+	PackedByteArray mutes = state.get("channel_mutes", PackedByteArray());
+	PackedByteArray solos = state.get("channel_solos", PackedByteArray());
+	auto num_channels = static_cast<int64_t>(channel_mutes.size());
+	for (int64_t i = 0; i < std::min(volumes.size(), num_channels); i++) {
+		volume_settings[i].store(volumes[i], std::memory_order_relaxed);
+	}
+	request_changes(PENDING_CHANNEL_VOLUMES);
+	for (int64_t i = 0; i < std::min(mutes.size(), num_channels); i++) {
+		channel_mutes[i] = mutes[i] != 0;
+	}
+	for (int64_t i = 0; i < std::min(solos.size(), num_channels); i++) {
+		channel_solos[i] = solos[i] != 0;
+	}
+	apply_mute_status();
+
+	ERR_FAIL_COND_EDMSG(!state_restores.push(restore), "Too many playback states restored at once.");
+	sent_restore = restore;
+	sent_restore_generation = invalidate_position_history();
+}
+
+void AudioStreamGDMPT::set_channel_mute(int32_t channel, bool mute) {
+	ERR_FAIL_COND(!has_module());
+	ERR_FAIL_INDEX(channel, static_cast<int32_t>(channel_mutes.size()));
+
+	channel_mutes[channel] = mute;
+	apply_mute_status();
+}
+
+bool AudioStreamGDMPT::get_channel_mute(int32_t channel) const {
+	ERR_FAIL_INDEX_V(channel, static_cast<int32_t>(channel_mutes.size()), false);
+
+	return channel_mutes[channel];
+}
+
+void AudioStreamGDMPT::set_channel_solo(int32_t channel, bool solo) {
+	ERR_FAIL_COND(!has_module());
+	ERR_FAIL_INDEX(channel, static_cast<int32_t>(channel_solos.size()));
+
+	channel_solos[channel] = solo;
+	apply_mute_status();
+}
+
+bool AudioStreamGDMPT::get_channel_solo(int32_t channel) const {
+	ERR_FAIL_INDEX_V(channel, static_cast<int32_t>(channel_solos.size()), false);
+
+	return channel_solos[channel];
+}
+
+void AudioStreamGDMPT::set_channel_group(const String &name, const PackedInt32Array &channels) {
+	for (int64_t i = 0; i < channels.size(); i++) {
+		ERR_FAIL_INDEX(channels[i], static_cast<int32_t>(channel_mutes.size()));
+	}
+
+	channel_groups[name] = channels;
+}
+
+PackedInt32Array AudioStreamGDMPT::get_channel_group(const String &name) const {
+	auto it = channel_groups.find(name);
+	ERR_FAIL_COND_V_EDMSG(it == channel_groups.end(), PackedInt32Array(),
+			"No channel group named '" + name + "'.");
+
+	return it->second;
+}
+
+void AudioStreamGDMPT::remove_channel_group(const String &name) {
+	channel_groups.erase(name);
+}
+
+PackedStringArray AudioStreamGDMPT::get_channel_group_names() const {
+	PackedStringArray names;
+	for (const auto &group : channel_groups) {
+		names.push_back(group.first);
+	}
+	return names;
+}
+
+void AudioStreamGDMPT::set_group_mute(const String &name, bool mute) {
+	ERR_FAIL_COND(!has_module());
+	auto it = channel_groups.find(name);
+	ERR_FAIL_COND_EDMSG(it == channel_groups.end(), "No channel group named '" + name + "'.");
+
+	const auto &channels = it->second;
+	for (int64_t i = 0; i < channels.size(); i++) {
+		// Channels can be gone after a reload
+		if (channels[i] < static_cast<int32_t>(channel_mutes.size())) {
+			channel_mutes[channels[i]] = mute;
+		}
+	}
+	apply_mute_status();
+}
+
+void AudioStreamGDMPT::set_group_solo(const String &name, bool solo) {
+	ERR_FAIL_COND(!has_module());
+	auto it = channel_groups.find(name);
+	ERR_FAIL_COND_EDMSG(it == channel_groups.end(), "No channel group named '" + name + "'.");
+
+	const auto &channels = it->second;
+	for (int64_t i = 0; i < channels.size(); i++) {
+		// Channels can be gone after a reload
+		if (channels[i] < static_cast<int32_t>(channel_solos.size())) {
+			channel_solos[channels[i]] = solo;
+		}
+	}
+	apply_mute_status();
 }
 
 Ref<AudioStreamPlayback> AudioStreamGDMPT::_instantiate_playback() const {
-	ERR_FAIL_COND_V(module.is_null(), nullptr);
+	ERR_FAIL_COND_V(!has_module(), nullptr);
 
 	Ref<AudioStreamGDMPTPlayback> playback;
 	playback.instantiate();
 
 	playback->stream = Ref<AudioStreamGDMPT>(this);
 	playback->active = false;
+	connect_render_events();
 
 	return playback;
 }
@@ -201,11 +916,9 @@ Ref<AudioStreamPlayback> AudioStreamGDMPT::_instantiate_playback() const {
 String AudioStreamGDMPT::_get_stream_name() const { return ""; }
 
 double AudioStreamGDMPT::_get_length() const {
-	ERR_FAIL_COND_V(module.is_null(), 0.0);
+	ERR_FAIL_COND_V(subsongs.empty(), 0.0);
 
-	auto length = module.get_duration_seconds();
-	OPENMPT_ERR_FAIL_V_EDMSG(this, 0.0);
-	return length;
+	return subsongs[subsong.load(std::memory_order_relaxed)].duration_seconds;
 }
 
 bool AudioStreamGDMPT::_is_monophonic() const {
@@ -214,11 +927,9 @@ bool AudioStreamGDMPT::_is_monophonic() const {
 }
 
 double AudioStreamGDMPT::_get_bpm() const {
-	ERR_FAIL_COND_V(module.is_null(), 0.0);
+	ERR_FAIL_COND_V(subsongs.empty(), 0.0);
 
-	auto bpm = module.get_current_estimated_bpm();
-	OPENMPT_ERR_FAIL_V_EDMSG(this, 0.0);
-	return bpm;
+	return subsongs[subsong.load(std::memory_order_relaxed)].initial_bpm;
 }
 
 int32_t AudioStreamGDMPT::_get_beat_count() const {
@@ -226,22 +937,883 @@ int32_t AudioStreamGDMPT::_get_beat_count() const {
 	return 0;
 }
 
-void AudioStreamGDMPT::emit_looping_signal() {
-	// Signal was registered on this class so it has to be sent from here too
-	emit_signal(LOOPING_SIGNAL);
+int32_t AudioStreamGDMPT::mix(AudioFrame *dst_buffer, int32_t frame_count, int32_t &loops, int32_t rate_divider, int32_t lod_tier) {
+	apply_pending_changes();
+	if (lod_tier != applied_lod_tier) {
+		applied_lod_tier = lod_tier;
+		apply_render_quality();
+	}
+	if (!rendering_ahead) {
+		process_state_restores(loops);
+		process_jump_commands();
+		process_note_commands();
+	}
+
+	// Guard against potential infinite loop
+	int loop_guard = 0;
+
+	int32_t total_rendered = 0;
+	bool idle_heard = false;
+	last_mix_idle = mix_idle && can_mix_idle(frame_count, rate_divider);
+	if (last_mix_idle) {
+		total_rendered = mix_idle_frames(dst_buffer, frame_count, rate_divider, idle_heard);
+	}
+	int32_t remaining_frames = frame_count - total_rendered;
+
+	while (total_rendered < frame_count && loop_guard < 3) {
+		// Pending jumps are checked between smaller chunks to catch their
+		// boundary
+		auto frames_to_render = remaining_frames;
+		if (pending_jump_count > 0) {
+			frames_to_render = std::min(frames_to_render, jump_chunk_frames);
+		}
+
+		// Notes are split out of the chunk at their frame
+		auto frame = frames_rendered_total + static_cast<uint64_t>(total_rendered) * rate_divider;
+		apply_due_notes(frame);
+		if (pending_note_count > 0) {
+			auto frames_to_note = (pending_notes[0].frame - frame + rate_divider - 1) / rate_divider;
+			frames_to_render = static_cast<int32_t>(std::min<uint64_t>(frames_to_render, frames_to_note));
+		}
+
+		auto frames_rendered = module.read_interleaved_float_stereo(
+				static_cast<int32_t>(SAMPLING_RATE) / rate_divider,
+				static_cast<size_t>(frames_to_render),
+				reinterpret_cast<float *>(dst_buffer + total_rendered));
+		OPENMPT_ERR_FAIL_V_RENDER(this, 0);
+
+		total_rendered += frames_rendered;
+		remaining_frames -= frames_rendered;
+
+		bool end_of_song = frames_rendered == 0;
+		if (end_of_song) {
+			loop_guard++;
+		} else if (pending_jump_count > 0) {
+			update_pending_jumps();
+		}
+
+		if (end_of_song && loop) {
+			loops++;
+			seek_module(0.0);
+			OPENMPT_ERR_FAIL_V_RENDER(this, total_rendered);
+			restore_channel_volumes();
+			emit_looping_signal();
+		}
+	}
+
+	// Positions and clocks are kept in frames at `SAMPLING_RATE`
+	auto position = module.get_current_position();
+	update_mix_idle(position, dst_buffer, total_rendered);
+	if (idle_heard) {
+		mix_idle = false;
+	}
+	if (!rendering_ahead) {
+		publish_position(position, static_cast<int64_t>(total_rendered) * rate_divider, loops);
+	}
+	update_tempo_lock(position, total_rendered * rate_divider);
+	return total_rendered;
 }
 
-std::optional<String> AudioStreamGDMPT::pop_last_openmpt_error() const {
-	if (openmpt_error == OPENMPT_ERROR_OK) {
-		return std::nullopt;
+void AudioStreamGDMPT::restore_channel_volumes() {
+	// libopenmpt resets the channel volumes when changing the position
+	for (int32_t i = 0; i < static_cast<int32_t>(mute_status.size()); i++) {
+		module.set_channel_volume(i, volume_settings[i].load(std::memory_order_relaxed));
+	}
+}
+
+void AudioStreamGDMPT::request_changes(uint32_t changes) {
+	// Releases the values stored before
+	pending_changes.fetch_or(changes, std::memory_order_release);
+}
+
+void AudioStreamGDMPT::apply_pending_changes() {
+	// Before the changes, so that a later seek is never stamped with an older
+	// generation
+	history_generation = position_generation.load(std::memory_order_acquire);
+
+	if (reload_state.load(std::memory_order_acquire) == RELOAD_READY) {
+		// Tried again by the next mix if the main thread reads patterns
+		try_swap_reloaded_module();
+	}
+
+	auto changes = pending_changes.exchange(0, std::memory_order_acquire);
+	if (changes == 0) {
+		return;
+	}
+	// A seek or a channel that is unmuted can start a sound
+	mix_idle = false;
+
+	if (changes & PENDING_SUBSONG) {
+		// Selecting a subsong seeks to its start
+		RealtimeAllocationScope allocations_allowed;
+		module.select_subsong(subsong.load(std::memory_order_relaxed));
+		changes |= PENDING_CHANNEL_VOLUMES;
+		tempo_lock_reset.store(true, std::memory_order_relaxed);
+	}
+	if (changes & PENDING_SEEK) {
+		seek_module(seek_position.load(std::memory_order_relaxed));
+		changes |= PENDING_CHANNEL_VOLUMES;
+		tempo_lock_reset.store(true, std::memory_order_relaxed);
+	}
+	if (changes & PENDING_CHANNEL_VOLUMES) {
+		restore_channel_volumes();
+	}
+	if (changes & PENDING_MUTE_STATUS) {
+		for (size_t i = 0; i < mute_status.size(); i++) {
+			mute_status[i] = requested_mute_status[i].load(std::memory_order_relaxed);
+		}
+		module.set_channels_mute_status(mute_status);
+	}
+	// The tempo lock restores the factor itself when disabled
+	if ((changes & PENDING_TEMPO_FACTOR) && !tempo_lock_active) {
+		module.set_tempo_factor(tempo_factor.load(std::memory_order_relaxed));
+	}
+	if (changes & PENDING_PITCH_FACTOR) {
+		module.set_pitch_factor(pitch_factor.load(std::memory_order_relaxed));
+	}
+	if (changes & PENDING_RENDER_QUALITY) {
+		apply_render_quality();
+	}
+	report_render_error();
+}
+
+void AudioStreamGDMPT::seek_module(double position) {
+	GDMPT_TRACE_SCOPE("seek");
+	// libopenmpt allocates while seeking
+	RealtimeAllocationScope allocations_allowed;
+	module.set_position_seconds(position);
+}
+
+void AudioStreamGDMPT::process_jump_commands() {
+	bool had_pending_jumps = pending_jump_count > 0;
+
+	JumpCommand command;
+	while (jump_commands.pop(command)) {
+		switch (command.type) {
+			case JumpCommand::QUEUE:
+				// `queue_jump` does not send more than `MAX_QUEUED_JUMPS`
+				pending_jumps[pending_jump_count++] = command;
+				break;
+			case JumpCommand::CANCEL:
+				for (int32_t i = 0; i < pending_jump_count; i++) {
+					if (pending_jumps[i].id == command.id) {
+						std::move(pending_jumps.begin() + i + 1, pending_jumps.begin() + pending_jump_count,
+								pending_jumps.begin() + i);
+						pending_jump_count--;
+						queued_jump_count.fetch_sub(1, std::memory_order_release);
+						break;
+					}
+				}
+				break;
+			case JumpCommand::CANCEL_ALL:
+				queued_jump_count.fetch_sub(pending_jump_count, std::memory_order_release);
+				pending_jump_count = 0;
+				break;
+		}
+	}
+
+	if (!had_pending_jumps && pending_jump_count > 0) {
+		// Only establishes the current position
+		jump_check_order = -1;
+		update_pending_jumps();
+	}
+}
+
+void AudioStreamGDMPT::process_note_commands() {
+	NoteCommand command;
+	while (note_commands.pop(command)) {
+		// `send_note_command` does not send more than `MAX_QUEUED_NOTES`.
+		// Commands with the same frame stay in the order they were sent.
+		auto it = std::upper_bound(pending_notes.begin(), pending_notes.begin() + pending_note_count, command,
+				[](const NoteCommand &a, const NoteCommand &b) { return a.frame < b.frame; });
+		std::move_backward(it, pending_notes.begin() + pending_note_count,
+				pending_notes.begin() + pending_note_count + 1);
+		*it = command;
+		pending_note_count++;
+	}
+}
+
+void AudioStreamGDMPT::apply_due_notes(uint64_t frame) {
+	int32_t applied = 0;
+	for (; applied < pending_note_count && pending_notes[applied].frame <= frame; applied++) {
+		const auto &command = pending_notes[applied];
+
+		if (command.type == NoteCommand::STOP) {
+			for (auto &voice : voices) {
+				if (voice.id == command.id) {
+					if (is_voice_on_channel(voice)) {
+						module.stop_note(voice.channel);
+					}
+					voice = Voice();
+					break;
+				}
+			}
+			continue;
+		}
+
+		auto index = allocate_voice();
+		auto &voice = voices[index];
+		if (is_voice_on_channel(voice)) {
+			// Every voice is still playing, the oldest one is stolen
+			module.stop_note(voice.channel);
+		}
+		voice = Voice();
+
+		auto channel = module.play_note(command.instrument, command.note, command.volume, command.panning);
+		if (channel < 0) {
+			continue;
+		}
+
+		// libopenmpt reuses the channels of notes that ended by themselves
+		for (auto &other : voices) {
+			if (other.channel == channel) {
+				other = Voice();
+			}
+		}
+		module.set_note_finetune(channel, tag_finetune(command.finetune, index));
+		voice.id = command.id;
+		voice.channel = channel;
+		voice.finetune = module.get_note_finetune(channel);
+		voice.started = ++voices_started;
+	}
+
+	if (applied > 0) {
+		std::move(pending_notes.begin() + applied, pending_notes.begin() + pending_note_count, pending_notes.begin());
+		pending_note_count -= applied;
+		queued_note_count.fetch_sub(applied, std::memory_order_release);
+	}
+}
+
+bool AudioStreamGDMPT::is_voice_on_channel(const Voice &voice) const {
+	// Without the interactive2 interface both are 0 and the channel is assumed
+	// to be unchanged
+	return voice.channel != -1 && module.get_note_finetune(voice.channel) == voice.finetune;
+}
+
+int32_t AudioStreamGDMPT::allocate_voice() const {
+	static_assert(MAX_VOICES < VOICE_TAG_STEPS, "Voices do not fit in the finetune tag");
+
+	int32_t taken_over = -1;
+	int32_t oldest = 0;
+	for (int32_t i = 0; i < MAX_VOICES; i++) {
+		const auto &voice = voices[i];
+		if (voice.channel == -1) {
+			return i;
+		}
+		if (taken_over == -1 && !is_voice_on_channel(voice)) {
+			taken_over = i;
+		}
+		if (voice.started < voices[oldest].started) {
+			oldest = i;
+		}
+	}
+	return taken_over != -1 ? taken_over : oldest;
+}
+
+void AudioStreamGDMPT::process_state_restores(int32_t &loops) {
+	StateRestore restore;
+	bool restored = false;
+	while (state_restores.pop(restore)) {
+		restored = true;
+	}
+	if (!restored) {
+		return;
+	}
+	mix_idle = false;
+
+	if (restore.seconds >= 0.0) {
+		seek_module(restore.seconds);
 	} else {
-		auto err_msg = OpenMPTString(openmpt_error_string(openmpt_error));
+		{
+			// libopenmpt still simulates the song up to the row to find its
+			// time in seconds, which allocates and takes longer the further
+			// the row is into the song
+			RealtimeAllocationScope allocations_allowed;
+			module.set_position_order_row(restore.order, restore.row);
+		}
+		// Ordering and row alone do not bring back what earlier rows set
+		if (restore.speed > 0) {
+			module.set_current_speed(restore.speed);
+		}
+		if (restore.tempo > 0.0) {
+			module.set_current_tempo(restore.tempo);
+		}
+		module.set_global_volume(restore.global_volume);
+	}
+	restore_channel_volumes();
+	report_render_error();
+
+	loops = restore.loops;
+	tempo_lock_reset.store(true, std::memory_order_relaxed);
+	jump_check_order = -1;
+	last_order = -1;
+}
+
+void AudioStreamGDMPT::update_pending_jumps() {
+	auto position = module.get_current_position();
+	auto rows_per_beat = get_rows_per_beat(position);
+	const auto &jump = pending_jumps[0];
+
+	bool order_changed = position.order != jump_check_order;
+	bool row_changed = order_changed || position.row != jump_check_row;
+	if (row_changed && jump_check_order != -1) {
+		bool at_boundary = false;
+		switch (jump.boundary) {
+			case JUMP_BOUNDARY_NEXT_ROW:
+				at_boundary = true;
+				break;
+			case JUMP_BOUNDARY_NEXT_BEAT:
+				at_boundary = order_changed || position.row % rows_per_beat == 0;
+				break;
+			case JUMP_BOUNDARY_PATTERN_END:
+				at_boundary = order_changed || position.row < jump_check_row;
+				break;
+		}
+
+		if (at_boundary) {
+			auto id = jump.id;
+			auto order = jump.order;
+			auto row = jump.row;
+			std::move(pending_jumps.begin() + 1, pending_jumps.begin() + pending_jump_count, pending_jumps.begin());
+			pending_jump_count--;
+			queued_jump_count.fetch_sub(1, std::memory_order_release);
+
+			{
+				// libopenmpt allocates while seeking
+				RealtimeAllocationScope allocations_allowed;
+				module.set_position_order_row(order, row);
+			}
+			restore_channel_volumes();
+
+			RenderEvent event;
+			event.type = RenderEvent::JUMP_APPLIED;
+			event.args[0] = id;
+			event.args[1] = order;
+			event.args[2] = row;
+			push_render_event(event);
+
+			// The position is established again after the next chunk
+			jump_check_order = -1;
+			jump_chunk_frames = JUMP_FINE_CHUNK_FRAMES;
+			return;
+		}
+	}
+	jump_check_order = position.order;
+	jump_check_row = position.row;
+
+	// Rendering is coarse until the last row before the boundary. A pattern
+	// break on another row is caught up to `JUMP_COARSE_CHUNK_FRAMES` late.
+	bool last_row = true;
+	if (jump.boundary != JUMP_BOUNDARY_NEXT_ROW) {
+		auto num_rows = module.get_pattern_num_rows(position.pattern);
+		last_row = position.row + 1 >= num_rows ||
+				(jump.boundary == JUMP_BOUNDARY_NEXT_BEAT && (position.row + 1) % rows_per_beat == 0);
+	}
+	jump_chunk_frames = last_row ? JUMP_FINE_CHUNK_FRAMES : JUMP_COARSE_CHUNK_FRAMES;
+}
+
+void AudioStreamGDMPT::update_mix_idle(const ModulePosition &position, const AudioFrame *buffer, int32_t frame_count) {
+	mix_idle = false;
+	if (pending_note_count > 0 || frame_count == 0) {
+		return;
+	}
+	if (position.playing_channels > 0 && !all_channels_muted.load(std::memory_order_relaxed)) {
+		return;
+	}
+	for (int32_t i = 0; i < frame_count; i++) {
+		if (buffer[i].left != 0.0f || buffer[i].right != 0.0f) {
+			return;
+		}
+	}
+	mix_idle = true;
+}
+
+bool AudioStreamGDMPT::can_mix_idle(int32_t frame_count, int32_t rate_divider) const {
+	if (pending_note_count > 0 || pending_jump_count > 0) {
+		return false;
+	}
+	// Whole idle frames only, so that no time is lost
+	auto frames = static_cast<int64_t>(frame_count) * rate_divider;
+	if (rate_divider >= IDLE_RATE_DIVIDER || frames % IDLE_RATE_DIVIDER != 0) {
+		return false;
+	}
+	// The estimate runs up to a mix late, which the tick covers. A row that
+	// starts early, e.g. after a tempo change, can lose up to a mix of sound.
+	return frames_per_row > 0 && frames_in_row + frames + frames_per_tick <= frames_per_row;
+}
+
+int32_t AudioStreamGDMPT::mix_idle_frames(AudioFrame *dst_buffer, int32_t frame_count, int32_t rate_divider, bool &heard) {
+	// Fits into `dst_buffer` as the idle rate is lower
+	auto idle_frames = static_cast<int64_t>(frame_count) * rate_divider / IDLE_RATE_DIVIDER;
+	auto frames_rendered = module.read_interleaved_float_stereo(
+			static_cast<int32_t>(SAMPLING_RATE) / IDLE_RATE_DIVIDER,
+			static_cast<size_t>(idle_frames),
+			reinterpret_cast<float *>(dst_buffer));
+	OPENMPT_ERR_FAIL_V_RENDER(this, 0);
+
+	heard = std::any_of(dst_buffer, dst_buffer + frames_rendered,
+			[](const AudioFrame &frame) { return frame.left != 0.0f || frame.right != 0.0f; });
+
+	auto frames = static_cast<int64_t>(frames_rendered) == idle_frames
+			? frame_count
+			: static_cast<int32_t>(frames_rendered * IDLE_RATE_DIVIDER / rate_divider);
+	std::fill_n(dst_buffer, frames, AudioFrame(0.0f, 0.0f));
+	return frames;
+}
+
+void AudioStreamGDMPT::publish_position(const ModulePosition &position, int64_t frames_rendered, int32_t loops) {
+	if (position.order != last_order || position.row != last_row) {
+		last_order = position.order;
+		last_row = position.row;
+		frames_in_row = 0;
+	} else {
+		frames_in_row += frames_rendered;
+	}
+
+	// Classic tempo mode: a tick lasts 2.5 / tempo seconds
+	int32_t tick = 0;
+	double effective_tempo = position.tempo * position.tempo_factor;
+	frames_per_tick = 0.0;
+	frames_per_row = 0;
+	if (effective_tempo > 0.0) {
+		frames_per_tick = SAMPLING_RATE * 2.5 / effective_tempo;
+		frames_per_row = static_cast<int64_t>(frames_per_tick * position.speed);
+		tick = static_cast<int32_t>(frames_in_row / frames_per_tick);
+		tick = std::clamp(tick, 0, std::max(position.speed - 1, 0));
+	}
+
+	PositionSnapshot snapshot;
+	snapshot.order = position.order;
+	snapshot.row = static_cast<int16_t>(position.row);
+	snapshot.tick = static_cast<int16_t>(tick);
+	position_snapshot.store(snapshot, std::memory_order_release);
+
+	frames_rendered_total += frames_rendered;
+
+	PositionStamp stamp;
+	stamp.frames = frames_rendered_total;
+	stamp.seconds = position.seconds;
+	stamp.order = snapshot.order;
+	stamp.row = snapshot.row;
+	stamp.tick = snapshot.tick;
+	stamp.speed = position.speed;
+	stamp.loops = loops;
+	stamp.tempo = position.tempo;
+	stamp.global_volume = position.global_volume;
+	stamp.generation = history_generation;
+	position_history.push(stamp);
+}
+
+uint32_t AudioStreamGDMPT::invalidate_position_history() {
+	return position_generation.fetch_add(1, std::memory_order_release) + 1;
+}
+
+void AudioStreamGDMPT::request_seek(double position) {
+	// Applied by the next mix
+	seek_position.store(position, std::memory_order_relaxed);
+	request_changes(PENDING_SEEK);
+	sent_seek_generation = invalidate_position_history();
+}
+
+bool AudioStreamGDMPT::find_audible_position(PositionStamp &stamp, double &seconds) const {
+	// The newest entry can be overwritten while reading when the history is
+	// small compared to the mix rate, so retry a few times
+	for (int32_t attempt = 0; attempt < 4; attempt++) {
+		auto count = position_history.size();
+		if (count == 0) {
+			return false;
+		}
+		PositionStamp latest;
+		if (!position_history.read(count - 1, latest)) {
+			continue;
+		}
+		if (latest.generation != position_generation.load(std::memory_order_acquire)) {
+			// The position changed and nothing was rendered since
+			return false;
+		}
+
+		// What is heard now was rendered `delay` seconds before the end of the
+		// last mix
+		auto audio_server = AudioServer::get_singleton();
+		double delay = audio_server->get_output_latency() - audio_server->get_time_since_last_mix();
+		auto delay_frames = static_cast<uint64_t>(std::max(delay, 0.0) * SAMPLING_RATE);
+		auto audible_frame = latest.frames > delay_frames ? latest.frames - delay_frames : 0;
+
+		// Oldest block that ends at or after the audible frame
+		stamp = latest;
+		for (auto index = count - 1; index > 0; index--) {
+			PositionStamp previous;
+			if (!position_history.read(index - 1, previous) || previous.frames < audible_frame ||
+					previous.generation != latest.generation) {
+				break;
+			}
+			stamp = previous;
+		}
+
+		seconds = std::max(stamp.seconds - (stamp.frames - std::min(stamp.frames, audible_frame)) / SAMPLING_RATE, 0.0);
+		return true;
+	}
+	return false;
+}
+
+void AudioStreamGDMPT::update_tempo_lock(const ModulePosition &position, int32_t frames_rendered) {
+	auto target_bpm = tempo_lock_bpm.load(std::memory_order_acquire);
+	if (target_bpm <= 0.0) {
+		if (tempo_lock_active) {
+			// Catches a factor applied after `set_tempo_lock_bpm` restored it
+			tempo_lock_active = false;
+			module.set_tempo_factor(tempo_factor.load(std::memory_order_relaxed));
+		}
+		return;
+	}
+	if (position.estimated_bpm <= 0.0) {
+		return;
+	}
+
+	tempo_lock_active = true;
+	if (tempo_lock_reset.exchange(false, std::memory_order_relaxed)) {
+		tempo_lock_reference_beats = 0.0;
+		tempo_lock_module_beats = 0.0;
+	}
+
+	double minutes = frames_rendered / SAMPLING_RATE / 60.0;
+	tempo_lock_reference_beats += minutes * target_bpm;
+	tempo_lock_module_beats += minutes * position.estimated_bpm * position.tempo_factor;
+
+	double drift_beats = tempo_lock_reference_beats - tempo_lock_module_beats;
+	tempo_lock_drift.store(drift_beats * 60.0 / target_bpm, std::memory_order_relaxed);
+
+	// Follows tempo changes of the module on the next block and catches up on
+	// the accumulated drift over `TEMPO_LOCK_CATCH_UP_BEATS`
+	double correction = std::clamp(drift_beats / TEMPO_LOCK_CATCH_UP_BEATS,
+			-TEMPO_LOCK_MAX_CORRECTION, TEMPO_LOCK_MAX_CORRECTION);
+	double factor = target_bpm / position.estimated_bpm * (1.0 + correction);
+	if (std::abs(factor - position.tempo_factor) > TEMPO_LOCK_FACTOR_EPSILON) {
+		module.set_tempo_factor(factor);
+	}
+}
+
+void AudioStreamGDMPT::render_prepared() {
+	// Runs in place of the render thread, which may still be finishing a
+	// playback. The playback then seeks by itself.
+	if (!try_claim_render()) {
+		prepare_state = PREPARE_NONE;
+		return;
+	}
+	apply_pending_changes();
+	seek_module(prepared_position);
+	tempo_lock_reset.store(true, std::memory_order_relaxed);
+	restore_channel_volumes();
+
+	prepared_loops = 0;
+	prepared_buffer.resize(PREPARE_FRAMES);
+	// The frames are only heard once a playback takes them
+	rendering_ahead = true;
+	auto frames_rendered = mix(prepared_buffer.data(), PREPARE_FRAMES, prepared_loops);
+	rendering_ahead = false;
+	prepared_buffer.resize(frames_rendered);
+	prepared_end_position = module.get_current_position();
+	prepared_generation = module_generation.load(std::memory_order_relaxed);
+	release_render();
+
+	prepare_state = PREPARE_READY;
+}
+
+void AudioStreamGDMPT::wait_for_prepare() {
+	if (prepare_task_id == -1) {
+		return;
+	}
+	WorkerThreadPool::get_singleton()->wait_for_task_completion(prepare_task_id);
+	prepare_task_id = -1;
+}
+
+void AudioStreamGDMPT::parse_reloaded() {
+	GDMPT_TRACE_SCOPE("reload_parse");
+
+	auto buffer = reload_path.is_empty() ? reload_buffer : FileAccess::get_file_as_bytes(reload_path);
+	Ref<AudioStreamGDMPT> reloaded;
+	if (buffer.is_empty()) {
+		ERR_PRINT("Cannot open file '" + reload_path + "'.");
+	} else {
+		reloaded = create_from_data(buffer, -1);
+	}
+	if (reloaded.is_null()) {
+		reload_state.store(RELOAD_FAILED, std::memory_order_release);
+		return;
+	}
+
+	// Keeps the subsong if the new module still has it
+	auto current_subsong = subsong.load(std::memory_order_relaxed);
+	if (current_subsong < reloaded->get_subsong_count()) {
+		reloaded->module.select_subsong(current_subsong);
+		reloaded->subsong.store(current_subsong, std::memory_order_relaxed);
+	}
+
+	// Seeks to where the last mix ended, so that the render thread only has
+	// to seek again if it reached another row before the swap
+	auto snapshot = position_snapshot.load(std::memory_order_acquire);
+	if (snapshot.order < reloaded->get_num_orders()) {
+		GDMPT_TRACE_SCOPE("reload_seek");
+		reloaded->module.set_position_order_row(snapshot.order, snapshot.row);
+	}
+
+	// The main thread does not change the settings of channels that this
+	// stream does not have yet
+	for (int32_t i = get_num_channels(); i < reloaded->get_num_channels(); i++) {
+		volume_settings[i].store(reloaded->volume_settings[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		requested_mute_status[i].store(false, std::memory_order_relaxed);
+	}
+
+	reloaded_stream = reloaded;
+	reload_state.store(RELOAD_READY, std::memory_order_release);
+}
+
+bool AudioStreamGDMPT::try_swap_reloaded_module() {
+	int32_t readers = 0;
+	if (!module_readers.compare_exchange_strong(readers, -1, std::memory_order_acquire)) {
+		return false;
+	}
+	swap_reloaded_module();
+	module_readers.store(0, std::memory_order_release);
+	return true;
+}
+
+void AudioStreamGDMPT::swap_reloaded_module() {
+	GDMPT_TRACE_SCOPE("reload_swap");
+
+	auto position = module.get_current_position();
+	module.swap(reloaded_stream->module);
+	// Errors of the new module are reported by this stream
+	module.set_error_func(AudioStreamGDMPT::error_func, this);
+	// Within the capacity reserved at load
+	mute_status.resize(module.get_num_channels(), false);
+
+	auto reloaded_position = module.get_current_position();
+	if ((reloaded_position.order != position.order || reloaded_position.row != position.row) &&
+			position.order < module.get_num_orders()) {
+		// libopenmpt allocates while seeking
+		RealtimeAllocationScope allocations_allowed;
+		module.set_position_order_row(position.order, position.row);
+	}
+
+	// The notes played on the old module's background channels ended with it
+	voices.fill(Voice());
+	jump_check_order = -1;
+	last_order = -1;
+	tempo_lock_reset.store(true, std::memory_order_relaxed);
+	request_changes(PENDING_CHANNEL_VOLUMES | PENDING_MUTE_STATUS | PENDING_TEMPO_FACTOR |
+			PENDING_PITCH_FACTOR | PENDING_RENDER_QUALITY);
+	// A buffer prepared from the old module is not taken anymore
+	module_generation.fetch_add(1, std::memory_order_relaxed);
+
+	reload_state.store(RELOAD_SWAPPED, std::memory_order_release);
+}
+
+void AudioStreamGDMPT::finish_reload() {
+	WorkerThreadPool::get_singleton()->wait_for_task_completion(reload_task_id);
+	reload_task_id = -1;
+
+	bool success = reload_state.load(std::memory_order_acquire) == RELOAD_SWAPPED;
+	if (success) {
+		subsongs.swap(reloaded_stream->subsongs);
+		subsong.store(reloaded_stream->subsong.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		order_patterns.swap(reloaded_stream->order_patterns);
+		pattern_num_rows.swap(reloaded_stream->pattern_num_rows);
+		pattern_data.swap(reloaded_stream->pattern_data);
+		instrument_names = reloaded_stream->instrument_names;
+		// Empty after a reload from a buffer, whose module is not in the file
+		filename = reload_path;
+
+		auto num_channels = get_num_channels();
+		channel_mutes.resize(num_channels, false);
+		channel_solos.resize(num_channels, false);
+		apply_mute_status();
+	}
+
+	reloaded_stream.unref();
+	reload_buffer = PackedByteArray();
+	reload_path = String();
+	reload_state.store(RELOAD_NONE, std::memory_order_release);
+	emit_signal(RELOADED_SIGNAL, success);
+}
 
-		// Also clear the error so we don't keep returning it
-		openmpt_error = OPENMPT_ERROR_OK;
+bool AudioStreamGDMPT::take_prepared(double from_pos, std::vector<AudioFrame> &buffer, int32_t &loops) {
+	wait_for_prepare();
 
-		return String(err_msg.get());
+	if (prepare_state != PREPARE_READY) {
+		return false;
 	}
+	prepare_state = PREPARE_NONE;
+
+	// Anything else means the module is at the wrong position
+	if (std::abs(from_pos - prepared_position) > 1e-6) {
+		return false;
+	}
+	// Rendered from a module that was reloaded since
+	if (prepared_generation != module_generation.load(std::memory_order_relaxed)) {
+		return false;
+	}
+
+	buffer.clear();
+	buffer.swap(prepared_buffer);
+	loops += prepared_loops;
+	return true;
+}
+
+void AudioStreamGDMPT::apply_mute_status() {
+	bool any_solo = std::find(channel_solos.begin(), channel_solos.end(), true) != channel_solos.end();
+
+	bool all_muted = !channel_mutes.empty();
+	for (size_t i = 0; i < channel_mutes.size(); i++) {
+		bool mute = channel_mutes[i] || (any_solo && !channel_solos[i]);
+		requested_mute_status[i].store(mute, std::memory_order_relaxed);
+		all_muted = all_muted && mute;
+	}
+	request_changes(PENDING_MUTE_STATUS);
+
+	all_channels_muted.store(all_muted, std::memory_order_relaxed);
+}
+
+void AudioStreamGDMPT::apply_render_quality() {
+	// `DEFAULT_INTERPOLATION` lets libopenmpt choose, which is sinc
+	int32_t requested_filter = interpolation_filter.load();
+	int32_t filter = requested_filter;
+	if (filter == DEFAULT_INTERPOLATION) {
+		filter = SINC_INTERPOLATION;
+	}
+	// libopenmpt's default strength
+	int32_t volume_ramping = -1;
+
+	switch (std::max(governor_tier.load(), applied_lod_tier)) {
+		case GOVERNOR_TIER_FULL:
+			filter = requested_filter;
+			break;
+		case GOVERNOR_TIER_CUBIC:
+			filter = std::min(filter, static_cast<int32_t>(CUBIC_INTERPOLATION));
+			break;
+		case GOVERNOR_TIER_MINIMAL:
+			volume_ramping = 0;
+			[[fallthrough]];
+		case GOVERNOR_TIER_LINEAR:
+			filter = std::min(filter, static_cast<int32_t>(LINEAR_INTERPOLATION));
+			break;
+	}
+
+	module.set_interpolation_filter(filter);
+	OPENMPT_ERR_FAIL_V_RENDER(this, void());
+	module.set_volume_ramping(volume_ramping);
+}
+
+void AudioStreamGDMPT::set_governor_tier(int32_t tier) {
+	governor_tier.store(tier);
+	apply_render_quality();
+
+	RenderEvent event;
+	event.type = RenderEvent::GOVERNOR_TIER_CHANGED;
+	event.args[0] = tier;
+	push_render_event(event);
+}
+
+void AudioStreamGDMPT::emit_looping_signal() {
+	Tracer::record_instant("loop");
+
+	RenderEvent event;
+	event.type = RenderEvent::LOOPED;
+	push_render_event(event);
+}
+
+void AudioStreamGDMPT::push_render_event(const RenderEvent &event) {
+	if (!render_events.push(event)) {
+		dropped_render_events.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+bool AudioStreamGDMPT::report_render_error() {
+	auto error = openmpt_error.exchange(OPENMPT_ERROR_OK, std::memory_order_relaxed);
+	if (error == OPENMPT_ERROR_OK) {
+		return false;
+	}
+
+	RenderEvent event;
+	event.type = RenderEvent::OPENMPT_ERROR;
+	event.args[0] = error;
+	push_render_event(event);
+	return true;
+}
+
+void AudioStreamGDMPT::dispatch_render_events() {
+	RenderEvent event;
+	while (render_events.pop(event)) {
+		switch (event.type) {
+			case RenderEvent::LOOPED:
+				emit_signal(LOOPING_SIGNAL);
+				break;
+			case RenderEvent::JUMP_APPLIED:
+				emit_signal(JUMP_APPLIED_SIGNAL, event.args[0], event.args[1], event.args[2]);
+				break;
+			case RenderEvent::GOVERNOR_TIER_CHANGED:
+				emit_signal(GOVERNOR_TIER_CHANGED_SIGNAL, event.args[0]);
+				break;
+			case RenderEvent::OPENMPT_ERROR: {
+				auto err_msg = OpenMPTString(openmpt_error_string(static_cast<int>(event.args[0])));
+				ERR_PRINT(String("OpenMPT error while rendering: ") + (err_msg == nullptr ? "unknown" : err_msg.get()));
+			} break;
+		}
+	}
+
+	auto state = reload_state.load(std::memory_order_acquire);
+	if (state == RELOAD_READY && active_playbacks.load(std::memory_order_acquire) == 0) {
+		// Nothing mixes the stream to swap the module. Playbacks only start on
+		// this thread, a stopped one can still be finishing its mix.
+		wait_for_prepare();
+		if (try_claim_render()) {
+			if (reload_state.load(std::memory_order_acquire) == RELOAD_READY) {
+				try_swap_reloaded_module();
+			}
+			release_render();
+			state = reload_state.load(std::memory_order_acquire);
+		}
+	}
+	if (state == RELOAD_SWAPPED || state == RELOAD_FAILED) {
+		finish_reload();
+	}
+
+	auto dropped = dropped_render_events.exchange(0, std::memory_order_relaxed);
+	if (dropped > 0) {
+		WARN_PRINT("Dropped " + String::num_int64(dropped) + " signals or errors of the render thread.");
+	}
+
+	// Violations of every stream, reported by whichever stream gets here first
+	auto violations = RealtimeChecks::take_unreported();
+	if (violations.any()) {
+		ERR_PRINT("The audio thread allocated " + String::num_int64(violations.allocations) +
+				" times and locked a module " + String::num_int64(violations.lock_acquisitions) +
+				" times while rendering.");
+	}
+}
+
+void AudioStreamGDMPT::connect_render_events() const {
+	// Without a scene tree, e.g. under a custom `MainLoop`, the signals are
+	// not emitted
+	auto scene_tree = get_scene_tree();
+	if (scene_tree == nullptr) {
+		return;
+	}
+
+	// Connecting does not change what the stream plays
+	auto callable = callable_mp(const_cast<AudioStreamGDMPT *>(this), &AudioStreamGDMPT::dispatch_render_events);
+	if (!scene_tree->is_connected("process_frame", callable)) {
+		scene_tree->connect("process_frame", callable);
+	}
+}
+
+std::optional<String> AudioStreamGDMPT::pop_last_openmpt_error() const {
+	auto error = openmpt_error.exchange(OPENMPT_ERROR_OK, std::memory_order_relaxed);
+	if (error == OPENMPT_ERROR_OK) {
+		return std::nullopt;
+	}
+	auto err_msg = OpenMPTString(openmpt_error_string(error));
+	return String(err_msg.get());
 }
 
 int AudioStreamGDMPT::error_func(int error, void *ptr) {
@@ -258,6 +1830,32 @@ void AudioStreamGDMPT::_bind_methods() {
 			D_METHOD("load_from_file", "path"),
 			&AudioStreamGDMPT::load_from_file);
 
+	ClassDB::bind_method(D_METHOD("reload_from_buffer", "buffer"),
+			&AudioStreamGDMPT::reload_from_buffer);
+	ClassDB::bind_method(D_METHOD("reload_from_file", "path"),
+			&AudioStreamGDMPT::reload_from_file);
+	ClassDB::bind_method(D_METHOD("is_reloading"),
+			&AudioStreamGDMPT::is_reloading);
+	ClassDB::bind_method(D_METHOD("instantiate_subsong", "subsong", "buffer"),
+			&AudioStreamGDMPT::instantiate_subsong, DEFVAL(PackedByteArray()));
+	ClassDB::bind_static_method("AudioStreamGDMPT",
+			D_METHOD("set_tracing_enabled", "enable"),
+			&AudioStreamGDMPT::set_tracing_enabled);
+	ClassDB::bind_static_method("AudioStreamGDMPT",
+			D_METHOD("is_tracing_enabled"),
+			&AudioStreamGDMPT::is_tracing_enabled);
+	ClassDB::bind_static_method("AudioStreamGDMPT",
+			D_METHOD("save_trace", "path"),
+			&AudioStreamGDMPT::save_trace);
+	ClassDB::bind_static_method("AudioStreamGDMPT",
+			D_METHOD("get_realtime_violations"),
+			&AudioStreamGDMPT::get_realtime_violations);
+
+	ClassDB::bind_method(D_METHOD("prepare", "from_pos"),
+			&AudioStreamGDMPT::prepare);
+	ClassDB::bind_method(D_METHOD("is_prepared"),
+			&AudioStreamGDMPT::is_prepared);
+
 	ClassDB::bind_method(D_METHOD("get_filename"), &AudioStreamGDMPT::get_filename);
 
 	ClassDB::bind_method(D_METHOD("set_loop", "enable"),
@@ -269,6 +1867,13 @@ void AudioStreamGDMPT::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_tempo_factor"),
 			&AudioStreamGDMPT::get_tempo_factor);
 
+	ClassDB::bind_method(D_METHOD("set_tempo_lock_bpm", "bpm"),
+			&AudioStreamGDMPT::set_tempo_lock_bpm);
+	ClassDB::bind_method(D_METHOD("get_tempo_lock_bpm"),
+			&AudioStreamGDMPT::get_tempo_lock_bpm);
+	ClassDB::bind_method(D_METHOD("get_tempo_lock_drift"),
+			&AudioStreamGDMPT::get_tempo_lock_drift);
+
 	ClassDB::bind_method(D_METHOD("set_pitch_factor", "factor"),
 			&AudioStreamGDMPT::set_pitch_factor);
 	ClassDB::bind_method(D_METHOD("get_pitch_factor"),
@@ -279,38 +1884,197 @@ void AudioStreamGDMPT::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("get_interpolation_filter"),
 			&AudioStreamGDMPT::get_interpolation_filter);
 
+	ClassDB::bind_method(D_METHOD("get_num_orders"),
+			&AudioStreamGDMPT::get_num_orders);
+	ClassDB::bind_method(D_METHOD("get_num_patterns"),
+			&AudioStreamGDMPT::get_num_patterns);
+	ClassDB::bind_method(D_METHOD("get_order_pattern", "order"),
+			&AudioStreamGDMPT::get_order_pattern);
+	ClassDB::bind_method(D_METHOD("get_pattern_num_rows", "pattern"),
+			&AudioStreamGDMPT::get_pattern_num_rows);
+	ClassDB::bind_method(D_METHOD("get_pattern_data", "pattern"),
+			&AudioStreamGDMPT::get_pattern_data);
+	ClassDB::bind_method(D_METHOD("get_current_position"),
+			&AudioStreamGDMPT::get_current_position);
+	ClassDB::bind_method(D_METHOD("get_audible_position"),
+			&AudioStreamGDMPT::get_audible_position);
+
+	ClassDB::bind_method(D_METHOD("save_playback_state"),
+			&AudioStreamGDMPT::save_playback_state);
+	ClassDB::bind_method(D_METHOD("restore_playback_state", "state"),
+			&AudioStreamGDMPT::restore_playback_state);
+
+	ClassDB::bind_method(D_METHOD("queue_jump", "order", "row", "boundary"),
+			&AudioStreamGDMPT::queue_jump);
+	ClassDB::bind_method(D_METHOD("cancel_jump", "id"),
+			&AudioStreamGDMPT::cancel_jump);
+	ClassDB::bind_method(D_METHOD("cancel_all_jumps"),
+			&AudioStreamGDMPT::cancel_all_jumps);
+	ClassDB::bind_method(D_METHOD("get_queued_jump_count"),
+			&AudioStreamGDMPT::get_queued_jump_count);
+
+	ClassDB::bind_method(D_METHOD("play_note", "instrument", "pitch", "volume", "panning"),
+			&AudioStreamGDMPT::play_note, DEFVAL(1.0), DEFVAL(0.0));
+	ClassDB::bind_method(D_METHOD("stop_note", "id"),
+			&AudioStreamGDMPT::stop_note);
+	ClassDB::bind_method(D_METHOD("get_num_instruments"),
+			&AudioStreamGDMPT::get_num_instruments);
+	ClassDB::bind_method(D_METHOD("get_instrument_name", "instrument"),
+			&AudioStreamGDMPT::get_instrument_name);
+
+	ClassDB::bind_method(D_METHOD("set_channel_mute", "channel", "mute"),
+			&AudioStreamGDMPT::set_channel_mute);
+	ClassDB::bind_method(D_METHOD("get_channel_mute", "channel"),
+			&AudioStreamGDMPT::get_channel_mute);
+
+	ClassDB::bind_method(D_METHOD("set_channel_solo", "channel", "solo"),
+			&AudioStreamGDMPT::set_channel_solo);
+	ClassDB::bind_method(D_METHOD("get_channel_solo", "channel"),
+			&AudioStreamGDMPT::get_channel_solo);
+
+	ClassDB::bind_method(D_METHOD("set_channel_group", "name", "channels"),
+			&AudioStreamGDMPT::set_channel_group);
+	ClassDB::bind_method(D_METHOD("get_channel_group", "name"),
+			&AudioStreamGDMPT::get_channel_group);
+	ClassDB::bind_method(D_METHOD("remove_channel_group", "name"),
+			&AudioStreamGDMPT::remove_channel_group);
+	ClassDB::bind_method(D_METHOD("get_channel_group_names"),
+			&AudioStreamGDMPT::get_channel_group_names);
+
+	ClassDB::bind_method(D_METHOD("set_group_mute", "name", "mute"),
+			&AudioStreamGDMPT::set_group_mute);
+	ClassDB::bind_method(D_METHOD("set_group_solo", "name", "solo"),
+			&AudioStreamGDMPT::set_group_solo);
+
+	ClassDB::bind_method(D_METHOD("set_governor_enabled", "enable"),
+			&AudioStreamGDMPT::set_governor_enabled);
+	ClassDB::bind_method(D_METHOD("get_governor_enabled"),
+			&AudioStreamGDMPT::get_governor_enabled);
+
+	ClassDB::bind_method(D_METHOD("set_governor_budget", "budget"),
+			&AudioStreamGDMPT::set_governor_budget);
+	ClassDB::bind_method(D_METHOD("get_governor_budget"),
+			&AudioStreamGDMPT::get_governor_budget);
+
+	ClassDB::bind_method(D_METHOD("set_lod_reduced_audibility", "audibility"),
+			&AudioStreamGDMPT::set_lod_reduced_audibility);
+	ClassDB::bind_method(D_METHOD("get_lod_reduced_audibility"),
+			&AudioStreamGDMPT::get_lod_reduced_audibility);
+	ClassDB::bind_method(D_METHOD("set_lod_suspended_audibility", "audibility"),
+			&AudioStreamGDMPT::set_lod_suspended_audibility);
+	ClassDB::bind_method(D_METHOD("get_lod_suspended_audibility"),
+			&AudioStreamGDMPT::get_lod_suspended_audibility);
+
+	ClassDB::bind_method(D_METHOD("get_governor_tier"),
+			&AudioStreamGDMPT::get_governor_tier);
+
 	ClassDB::bind_method(D_METHOD("get_num_channels"),
 			&AudioStreamGDMPT::get_num_channels);
 
+	ClassDB::bind_method(D_METHOD("set_subsong", "subsong"),
+			&AudioStreamGDMPT::set_subsong);
+	ClassDB::bind_method(D_METHOD("get_subsong"),
+			&AudioStreamGDMPT::get_subsong);
+	ClassDB::bind_method(D_METHOD("get_subsong_count"),
+			&AudioStreamGDMPT::get_subsong_count);
+	ClassDB::bind_method(D_METHOD("get_subsong_info", "subsong"),
+			&AudioStreamGDMPT::get_subsong_info);
+
 	ClassDB::bind_method(D_METHOD("set_channel_volume", "channel", "volume"),
 			&AudioStreamGDMPT::set_channel_volume);
 	ClassDB::bind_method(D_METHOD("get_channel_volume", "channel"),
 			&AudioStreamGDMPT::get_channel_volume);
 
 	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "loop"), "set_loop", "get_loop");
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "subsong"), "set_subsong", "get_subsong");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "tempo_factor"), "set_tempo_factor", "get_tempo_factor");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "tempo_lock_bpm"), "set_tempo_lock_bpm", "get_tempo_lock_bpm");
 	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "pitch_factor"), "set_pitch_factor", "get_pitch_factor");
 	ADD_PROPERTY(PropertyInfo(Variant::INT, "interpolation_filter"), "set_interpolation_filter", "get_interpolation_filter");
 
+	ADD_PROPERTY(PropertyInfo(Variant::BOOL, "governor_enabled"), "set_governor_enabled", "get_governor_enabled");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "governor_budget"), "set_governor_budget", "get_governor_budget");
+
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_reduced_audibility"), "set_lod_reduced_audibility", "get_lod_reduced_audibility");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "lod_suspended_audibility"), "set_lod_suspended_audibility", "get_lod_suspended_audibility");
+
 	ADD_SIGNAL(MethodInfo(LOOPING_SIGNAL));
+	ADD_SIGNAL(MethodInfo(GOVERNOR_TIER_CHANGED_SIGNAL, PropertyInfo(Variant::INT, "tier")));
+	ADD_SIGNAL(MethodInfo(JUMP_APPLIED_SIGNAL, PropertyInfo(Variant::INT, "id"),
+			PropertyInfo(Variant::INT, "order"), PropertyInfo(Variant::INT, "row")));
+	ADD_SIGNAL(MethodInfo(RELOADED_SIGNAL, PropertyInfo(Variant::BOOL, "success")));
 
 	BIND_ENUM_CONSTANT(DEFAULT_INTERPOLATION);
 	BIND_ENUM_CONSTANT(NO_INTERPOLATION);
 	BIND_ENUM_CONSTANT(LINEAR_INTERPOLATION);
 	BIND_ENUM_CONSTANT(CUBIC_INTERPOLATION);
 	BIND_ENUM_CONSTANT(SINC_INTERPOLATION);
+
+	BIND_ENUM_CONSTANT(PATTERN_COMMAND_NOTE);
+	BIND_ENUM_CONSTANT(PATTERN_COMMAND_INSTRUMENT);
+	BIND_ENUM_CONSTANT(PATTERN_COMMAND_VOLUME_EFFECT);
+	BIND_ENUM_CONSTANT(PATTERN_COMMAND_EFFECT);
+	BIND_ENUM_CONSTANT(PATTERN_COMMAND_VOLUME);
+	BIND_ENUM_CONSTANT(PATTERN_COMMAND_PARAMETER);
+	BIND_ENUM_CONSTANT(PATTERN_COMMAND_COUNT);
+
+	BIND_ENUM_CONSTANT(JUMP_BOUNDARY_NEXT_ROW);
+	BIND_ENUM_CONSTANT(JUMP_BOUNDARY_NEXT_BEAT);
+	BIND_ENUM_CONSTANT(JUMP_BOUNDARY_PATTERN_END);
+
+	BIND_ENUM_CONSTANT(GOVERNOR_TIER_FULL);
+	BIND_ENUM_CONSTANT(GOVERNOR_TIER_CUBIC);
+	BIND_ENUM_CONSTANT(GOVERNOR_TIER_LINEAR);
+	BIND_ENUM_CONSTANT(GOVERNOR_TIER_MINIMAL);
 }
 
-AudioStreamGDMPT::AudioStreamGDMPT() {}
+AudioStreamGDMPT::AudioStreamGDMPT() {
+	for (auto &volume : volume_settings) {
+		volume.store(1.0, std::memory_order_relaxed);
+	}
+	for (auto &mute : requested_mute_status) {
+		mute.store(false, std::memory_order_relaxed);
+	}
+}
+
+AudioStreamGDMPT::~AudioStreamGDMPT() {
+	// The tasks reference `this`
+	wait_for_prepare();
+	if (reload_task_id != -1) {
+		WorkerThreadPool::get_singleton()->wait_for_task_completion(reload_task_id);
+	}
+}
 
 ////////////////
 
 void AudioStreamGDMPTPlayback::_start(double from_pos) {
+	ERR_FAIL_NULL(stream);
+	if (!active) {
+		stream->active_playbacks.fetch_add(1, std::memory_order_acq_rel);
+	}
 	active = true;
-	_seek(from_pos);
+	prepared_offset = 0;
+	// The prepared buffer is rendered at the full rate
+	target_lod.store(RENDER_LOD_FULL, std::memory_order_relaxed);
+	render_lod.store(RENDER_LOD_FULL, std::memory_order_relaxed);
+
+	if (stream->take_prepared(from_pos, prepared_buffer, loops)) {
+		prepared_end_position = stream->prepared_end_position;
+		stream->seek_position.store(from_pos, std::memory_order_relaxed);
+		prepared_generation = stream->invalidate_position_history();
+		stream->sent_seek_generation = prepared_generation;
+	} else {
+		prepared_buffer.clear();
+		_seek(from_pos);
+	}
 }
 
-void AudioStreamGDMPTPlayback::_stop() { active = false; }
+void AudioStreamGDMPTPlayback::_stop() {
+	if (active && stream.is_valid()) {
+		stream->active_playbacks.fetch_sub(1, std::memory_order_acq_rel);
+	}
+	active = false;
+}
 
 bool AudioStreamGDMPTPlayback::_is_playing() const { return active; }
 
@@ -320,19 +2084,23 @@ int32_t AudioStreamGDMPTPlayback::_get_loop_count() const {
 
 double AudioStreamGDMPTPlayback::_get_playback_position() const {
 	ERR_FAIL_NULL_V(stream, 0.0);
-	ERR_FAIL_COND_V(stream->module.is_null(), 0.0);
+	ERR_FAIL_COND_V(!stream->has_module(), 0.0);
 
-	auto position = stream->module.get_position_seconds();
-	OPENMPT_ERR_FAIL_V_EDMSG(stream, 0.0);
-	return position;
+	PositionStamp stamp;
+	double seconds;
+	if (stream->find_audible_position(stamp, seconds)) {
+		return seconds;
+	}
+
+	// Nothing was rendered since the last seek or start
+	return stream->seek_position.load(std::memory_order_relaxed);
 }
 
 void AudioStreamGDMPTPlayback::_seek(double position) {
 	ERR_FAIL_NULL(stream);
-	ERR_FAIL_COND(stream->module.is_null());
+	ERR_FAIL_COND(!stream->has_module());
 
-	auto new_position = stream->module.set_position_seconds(position);
-	OPENMPT_ERR_FAIL_V_EDMSG(stream, void());
+	stream->request_seek(position);
 }
 
 int32_t AudioStreamGDMPTPlayback::_mix_resampled(AudioFrame *dst_buffer,
@@ -345,48 +2113,201 @@ int32_t AudioStreamGDMPTPlayback::_mix_resampled(AudioFrame *dst_buffer,
 	static_assert(std::alignment_of<AudioFrame>::value ==
 			std::alignment_of<float>::value);
 
+	GDMPT_TRACE_SCOPE("mix");
+	RealtimeScope realtime_scope;
+
 	ERR_FAIL_NULL_V(stream, 0);
-	ERR_FAIL_COND_V(stream->module.is_null(), 0);
+	ERR_FAIL_COND_V(!stream->has_module(), 0);
 
-	// Guard against potential infinite loop
-	int loop_guard = 0;
+	if (!stream->try_claim_render()) {
+		// The main thread is swapping a reloaded module
+		std::fill_n(dst_buffer, frame_count, AudioFrame(0.0f, 0.0f));
+		return frame_count;
+	}
+	auto frames_mixed = mix_claimed(dst_buffer, frame_count);
+	stream->release_render();
+	return frames_mixed;
+}
 
-	int32_t total_rendered = 0;
-	int32_t remaining_frames = frame_count;
+int32_t AudioStreamGDMPTPlayback::mix_claimed(AudioFrame *dst_buffer, int32_t frame_count) {
+	// The rate was reported to the resampler before this mix
+	auto lod = render_lod.load(std::memory_order_relaxed);
+
+	// Frames rendered ahead of time by `AudioStreamGDMPT::prepare`
+	int32_t frames_copied = 0;
+	if (prepared_offset < prepared_buffer.size()) {
+		frames_copied = static_cast<int32_t>(std::min(
+				static_cast<size_t>(frame_count), prepared_buffer.size() - prepared_offset));
+		std::copy_n(prepared_buffer.data() + prepared_offset, frames_copied, dst_buffer);
+		prepared_offset += frames_copied;
+		if (prepared_offset == prepared_buffer.size()) {
+			// Counted as a single block now that all of it was played. Not
+			// reported if the playback seeked since it started.
+			stream->history_generation = prepared_generation;
+			stream->publish_position(prepared_end_position, static_cast<int64_t>(prepared_buffer.size()), loops);
+		}
+		if (frames_copied == frame_count) {
+			update_render_lod();
+			return frames_copied;
+		}
+	}
 
-	while (total_rendered < frame_count && loop_guard < 3) {
-		loop_guard++;
-		auto frames_rendered = stream->module.read_interleaved_float_stereo(
-				static_cast<int32_t>(SAMPLING_RATE),
-				static_cast<size_t>(remaining_frames),
-				reinterpret_cast<float *>(dst_buffer + total_rendered));
-		OPENMPT_ERR_FAIL_V_EDMSG(stream, 0);
+	int32_t rate_divider = 1;
+	int32_t lod_tier = AudioStreamGDMPT::GOVERNOR_TIER_FULL;
+	if (lod == RENDER_LOD_REDUCED) {
+		rate_divider = LOD_REDUCED_RATE_DIVIDER;
+		lod_tier = AudioStreamGDMPT::GOVERNOR_TIER_LINEAR;
+	} else if (lod == RENDER_LOD_SUSPENDED) {
+		// Still rendered so that loops, jumps, notes and the position advance
+		// as usual, just cheap enough not to matter
+		rate_divider = LOD_SUSPENDED_RATE_DIVIDER;
+		lod_tier = AudioStreamGDMPT::GOVERNOR_TIER_MINIMAL;
+	}
 
-		total_rendered += frames_rendered;
-		remaining_frames -= frames_rendered;
+	auto start = std::chrono::steady_clock::now();
+	auto frames_rendered = stream->mix(
+			dst_buffer + frames_copied, frame_count - frames_copied, loops, rate_divider, lod_tier);
+	auto end = std::chrono::steady_clock::now();
 
-		bool end_of_song = frames_rendered == 0;
-		if (end_of_song && stream->loop) {
-			loops++;
-			_seek(0.0);
-			// `set_position_seconds` resets the volume
-			for (int i = 0; i < stream->volume_settings.size(); i++) {
-				stream->set_channel_volume(i, stream->volume_settings[i]);
-			}
-			stream->emit_looping_signal();
+	if (lod == RENDER_LOD_SUSPENDED) {
+		std::fill_n(dst_buffer + frames_copied, frames_rendered, AudioFrame(0.0f, 0.0f));
+	}
+
+	if (stream->last_mix_idle) {
+		// Compared to rendering at the rate of the LOD
+		auto frames = static_cast<uint64_t>(frames_rendered);
+		idle_mix_count.fetch_add(1, std::memory_order_relaxed);
+		idle_frames_saved.fetch_add(frames - frames * rate_divider / IDLE_RATE_DIVIDER, std::memory_order_relaxed);
+	}
+
+	update_governor(
+			std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+			(frame_count - frames_copied) * rate_divider);
+	update_render_lod();
+	return frames_copied + frames_rendered;
+}
+
+void AudioStreamGDMPTPlayback::update_render_lod() {
+	auto lod = target_lod.load(std::memory_order_relaxed);
+	auto new_lod = static_cast<int32_t>(RENDER_LOD_FULL);
+
+	// The prepared buffer was rendered at the full rate
+	bool prepared_left = prepared_offset < prepared_buffer.size();
+	if (!prepared_left) {
+		auto current_audibility = audibility.load(std::memory_order_relaxed);
+		// Going up a level needs more than reaching the threshold again
+		double suspended = stream->lod_suspended_audibility * (lod >= RENDER_LOD_SUSPENDED ? LOD_HYSTERESIS : 1.0);
+		double reduced = stream->lod_reduced_audibility * (lod >= RENDER_LOD_REDUCED ? LOD_HYSTERESIS : 1.0);
+		if (current_audibility < suspended) {
+			new_lod = RENDER_LOD_SUSPENDED;
+		} else if (current_audibility < reduced) {
+			new_lod = RENDER_LOD_REDUCED;
 		}
 	}
-	return total_rendered;
+	if (new_lod != lod) {
+		target_lod.store(new_lod, std::memory_order_relaxed);
+	}
+}
+
+void AudioStreamGDMPTPlayback::set_audibility(double p_audibility) {
+	audibility.store(std::max(p_audibility, 0.0), std::memory_order_relaxed);
+}
+
+double AudioStreamGDMPTPlayback::get_audibility() const {
+	return audibility.load(std::memory_order_relaxed);
+}
+
+AudioStreamGDMPTPlayback::RenderLOD AudioStreamGDMPTPlayback::get_render_lod() const {
+	return static_cast<RenderLOD>(render_lod.load(std::memory_order_relaxed));
+}
+
+int64_t AudioStreamGDMPTPlayback::get_idle_mix_count() const {
+	return static_cast<int64_t>(idle_mix_count.load(std::memory_order_relaxed));
+}
+
+int64_t AudioStreamGDMPTPlayback::get_idle_frames_saved() const {
+	return static_cast<int64_t>(idle_frames_saved.load(std::memory_order_relaxed));
+}
+
+void AudioStreamGDMPTPlayback::update_governor(uint64_t render_usec, int32_t frame_count) {
+	auto tier = stream->governor_tier.load();
+
+	if (!stream->governor_enabled) {
+		if (tier != AudioStreamGDMPT::GOVERNOR_TIER_FULL) {
+			stream->set_governor_tier(AudioStreamGDMPT::GOVERNOR_TIER_FULL);
+		}
+		return;
+	}
+	if (frame_count <= 0) {
+		return;
+	}
+
+	double callback_usec = frame_count / SAMPLING_RATE * 1000000.0;
+	double load = static_cast<double>(render_usec) / callback_usec;
+	governor_load += (load - governor_load) * GOVERNOR_SMOOTHING;
+
+	if (governor_load > stream->governor_budget) {
+		governor_under_budget = 0;
+		governor_over_budget++;
+		if (governor_over_budget >= GOVERNOR_STEP_DOWN_CALLBACKS &&
+				tier < AudioStreamGDMPT::GOVERNOR_TIER_MINIMAL) {
+			governor_over_budget = 0;
+			stream->set_governor_tier(tier + 1);
+		}
+	} else if (governor_load < stream->governor_budget * GOVERNOR_STEP_UP_RATIO) {
+		governor_over_budget = 0;
+		governor_under_budget++;
+		if (governor_under_budget >= GOVERNOR_STEP_UP_CALLBACKS &&
+				tier > AudioStreamGDMPT::GOVERNOR_TIER_FULL) {
+			governor_under_budget = 0;
+			stream->set_governor_tier(tier - 1);
+		}
+	} else {
+		governor_over_budget = 0;
+		governor_under_budget = 0;
+	}
 }
 
 double AudioStreamGDMPTPlayback::_get_stream_sampling_rate() const {
-	return SAMPLING_RATE;
+	// Asked once at the start of every mix. The LOD picked by the last mix
+	// takes effect here so that the next one renders at the reported rate.
+	auto lod = target_lod.load(std::memory_order_relaxed);
+	render_lod.store(lod, std::memory_order_relaxed);
+
+	switch (lod) {
+		case RENDER_LOD_REDUCED:
+			return SAMPLING_RATE / LOD_REDUCED_RATE_DIVIDER;
+		case RENDER_LOD_SUSPENDED:
+			return SAMPLING_RATE / LOD_SUSPENDED_RATE_DIVIDER;
+		default:
+			return SAMPLING_RATE;
+	}
 }
 
 void AudioStreamGDMPTPlayback::_bind_methods() {
-	// Purposely empty
+	ClassDB::bind_method(D_METHOD("set_audibility", "audibility"),
+			&AudioStreamGDMPTPlayback::set_audibility);
+	ClassDB::bind_method(D_METHOD("get_audibility"),
+			&AudioStreamGDMPTPlayback::get_audibility);
+	ClassDB::bind_method(D_METHOD("get_render_lod"),
+			&AudioStreamGDMPTPlayback::get_render_lod);
+	ClassDB::bind_method(D_METHOD("get_idle_mix_count"),
+			&AudioStreamGDMPTPlayback::get_idle_mix_count);
+	ClassDB::bind_method(D_METHOD("get_idle_frames_saved"),
+			&AudioStreamGDMPTPlayback::get_idle_frames_saved);
+
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "audibility"), "set_audibility", "get_audibility");
+
+	BIND_ENUM_CONSTANT(RENDER_LOD_FULL);
+	BIND_ENUM_CONSTANT(RENDER_LOD_REDUCED);
+	BIND_ENUM_CONSTANT(RENDER_LOD_SUSPENDED);
 }
 
 AudioStreamGDMPTPlayback::AudioStreamGDMPTPlayback() {}
 
+AudioStreamGDMPTPlayback::~AudioStreamGDMPTPlayback() {
+	// Playbacks can be freed without being stopped
+	_stop();
+}
+
 ////////////////
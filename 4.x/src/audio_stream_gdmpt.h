@@ -1,33 +1,524 @@
 #ifndef AUDIO_STREAM_GDMPT_H
 #define AUDIO_STREAM_GDMPT_H
 
+#include "godot_compat.h"
 #include "openmpt_module.h"
+#include "seqlock_ring.h"
+#include "spsc_queue.h"
 
-#include <godot_cpp/classes/audio_stream.hpp>
-#include <godot_cpp/classes/audio_stream_playback_resampled.hpp>
-
+#include <array>
+#include <atomic>
+#include <map>
 #include <optional>
 
+// Fails with the last OpenMPT error of the `AudioStreamGDMPT` `obj`, if any
+#define OPENMPT_ERR_FAIL_V_EDMSG(obj, m_retval)   \
+	auto err_msg = obj->pop_last_openmpt_error(); \
+	ERR_FAIL_COND_V_EDMSG(err_msg.has_value(), m_retval, err_msg.value())
+
+// Same for the render thread, which cannot build the message. The error is
+// queued and printed by the main thread.
+#define OPENMPT_ERR_FAIL_V_RENDER(obj, m_retval) \
+	if (obj->report_render_error()) {           \
+		return m_retval;                          \
+	}
+
 namespace godot {
 
-// Forward declaration to be able to add as a friend class
+// Godot's sampling rate
+// https://docs.godotengine.org/en/4.2/contributing/development/core_and_modules/custom_audiostreams.html
+constexpr double SAMPLING_RATE = 44100.0;
+
+// Forward declarations to be able to add as friend classes
 class AudioStreamGDMPTPlayback;
+class AudioStreamGDMPTLayers;
+class AudioStreamGDMPTLayersPlayback;
+
+// Position published by the render thread. Small enough to be a lock-free
+// atomic on 64-bit platforms.
+struct PositionSnapshot {
+	int32_t order = 0;
+	int16_t row = 0;
+	int16_t tick = 0;
+};
+
+// Position at the end of a rendered block, kept to find what is audible
+struct PositionStamp {
+	// Frames rendered by the stream up to the end of the block
+	uint64_t frames = 0;
+	double seconds = 0.0;
+	int32_t order = 0;
+	int16_t row = 0;
+	int16_t tick = 0;
+	// Song state saved by `save_playback_state`
+	int32_t speed = 0;
+	int32_t loops = 0;
+	double tempo = 0.0;
+	double global_volume = 1.0;
+	// `position_generation` the block was rendered for
+	uint32_t generation = 0;
+};
 
 class AudioStreamGDMPT : public AudioStream {
 	GDCLASS(AudioStreamGDMPT, AudioStream)
 
 	friend class AudioStreamGDMPTPlayback;
+	friend class AudioStreamGDMPTLayers;
+	friend class AudioStreamGDMPTLayersPlayback;
 
+	// Only used by the thread that loads the stream and then by the render
+	// thread, so the module is not locked. The main thread hands changes over
+	// through `pending_changes` and reads the tables below instead.
 	OpenMPTModule module;
+	// Set once `module` is loaded. Checked instead of `module`, which the
+	// render thread may be swapping for a reloaded one.
+	std::atomic<bool> module_loaded{ false };
+	// Read again by `instantiate_subsong`. Empty for streams loaded from a
+	// buffer, whose bytes are not kept.
 	String filename;
 	bool loop = false;
-	std::vector<double> volume_settings;
-	mutable int openmpt_error = OPENMPT_ERROR_OK; // mutable to access from const
+	// More than the channels of any module libopenmpt loads. The settings the
+	// render thread reads have this size so that a reload with more channels
+	// does not reallocate them.
+	static constexpr int32_t MAX_CHANNELS = 256;
+	std::array<std::atomic<double>, MAX_CHANNELS> volume_settings;
+	std::vector<bool> channel_mutes;
+	std::vector<bool> channel_solos;
+	// Combined from the mutes and solos by `apply_mute_status`. The render
+	// thread copies it to `mute_status`, which has room for `MAX_CHANNELS`.
+	std::array<std::atomic<bool>, MAX_CHANNELS> requested_mute_status;
+	std::vector<bool> mute_status;
+	// Read at load and only replaced by `finish_reload` on the main thread,
+	// so that the length, BPM and channel count are returned without locking
+	// the module
+	std::vector<SubsongMetadata> subsongs;
+	std::atomic<int32_t> subsong{ 0 };
+	// Structure of the module, read at load like `subsongs`
+	std::vector<int32_t> order_patterns;
+	std::vector<int32_t> pattern_num_rows;
+	// Built by `get_pattern_data` on first access, empty until then
+	mutable std::vector<PackedByteArray> pattern_data;
+	// Main thread calls reading patterns from `module`, or -1 while a reloaded
+	// module is swapped in. Rendering never writes the patterns, so they can
+	// be read while the render thread uses the module.
+	mutable std::atomic<int32_t> module_readers{ 0 };
+	PackedStringArray instrument_names;
+	// Named sets of channels that can be muted or soloed together
+	std::map<String, PackedInt32Array> channel_groups;
+	mutable std::atomic<int> openmpt_error{ OPENMPT_ERROR_OK }; // mutable to access from const
+
+	// Changes made by the main thread that the render thread applies before
+	// its next mix, one bit each. Later changes of the same kind replace
+	// earlier ones.
+	enum PendingChange : uint32_t {
+		PENDING_SUBSONG = 1 << 0,
+		PENDING_SEEK = 1 << 1,
+		PENDING_CHANNEL_VOLUMES = 1 << 2,
+		PENDING_MUTE_STATUS = 1 << 3,
+		PENDING_TEMPO_FACTOR = 1 << 4,
+		PENDING_PITCH_FACTOR = 1 << 5,
+		PENDING_RENDER_QUALITY = 1 << 6
+	};
+
+	std::atomic<uint32_t> pending_changes{ 0 };
+	// Target of `PENDING_SEEK`, also returned as the playback position until
+	// something was rendered
+	std::atomic<double> seek_position{ 0.0 };
+	std::atomic<double> pitch_factor{ 1.0 };
+
+	// A signal or error of the render thread, emitted or printed by the main
+	// thread
+	struct RenderEvent {
+		enum Type {
+			LOOPED,
+			// `args`: id, order, row
+			JUMP_APPLIED,
+			// `args`: tier
+			GOVERNOR_TIER_CHANGED,
+			// `args`: libopenmpt error code
+			OPENMPT_ERROR
+		};
+
+		Type type = LOOPED;
+		int64_t args[3] = {};
+	};
+
+	static constexpr int32_t MAX_RENDER_EVENTS = 64;
+
+	SPSCQueue<RenderEvent, MAX_RENDER_EVENTS> render_events;
+	// Events that did not fit, reported with the next dispatch
+	std::atomic<uint32_t> dropped_render_events{ 0 };
+
+	// Filter requested through `set_interpolation_filter`. The filter that is
+	// actually used can be lower depending on `governor_tier`.
+	std::atomic<int32_t> interpolation_filter{ 0 };
+	bool governor_enabled = false;
+	double governor_budget = 0.5;
+	// `GovernorTier`, written by the playback from the audio thread
+	std::atomic<int32_t> governor_tier{ 0 };
+
+	// Audibility below which playbacks render at a reduced rate or suspend
+	// rendering, see `AudioStreamGDMPTPlayback::set_audibility`
+	double lod_reduced_audibility = 0.1;
+	double lod_suspended_audibility = 0.001;
+	// Lowest `GovernorTier` allowed by the render LOD of the playback that
+	// mixes. Only used by the audio thread.
+	int32_t applied_lod_tier = 0;
+
+	// Last factor set through `set_tempo_factor`, restored when the tempo lock
+	// is disabled
+	std::atomic<double> tempo_factor{ 1.0 };
+	// Target BPM of the tempo lock or 0 if disabled. Followed by `mix` without
+	// involving the thread that set it.
+	std::atomic<double> tempo_lock_bpm{ 0.0 };
+	std::atomic<bool> tempo_lock_reset{ false };
+	// Drift of the module behind the reference clock, in seconds
+	std::atomic<double> tempo_lock_drift{ 0.0 };
+	// Only accessed by the render thread
+	bool tempo_lock_active = false;
+	double tempo_lock_reference_beats = 0.0;
+	double tempo_lock_module_beats = 0.0;
+
+	// A jump queued by `queue_jump` or a request to cancel jumps
+	struct JumpCommand {
+		enum Type {
+			QUEUE,
+			CANCEL,
+			CANCEL_ALL
+		};
+
+		Type type = QUEUE;
+		int64_t id = 0;
+		int32_t order = 0;
+		int32_t row = 0;
+		int32_t boundary = 0;
+	};
+
+	static constexpr int32_t MAX_QUEUED_JUMPS = 32;
+
+	// Sent from the main thread and applied by `mix`
+	SPSCQueue<JumpCommand, MAX_QUEUED_JUMPS * 2> jump_commands;
+	int64_t next_jump_id = 1;
+	// Jumps queued and not yet applied or cancelled
+	std::atomic<int32_t> queued_jump_count{ 0 };
+	// Only accessed by the render thread. `jump_check_order` and
+	// `jump_check_row` are the position after the last rendered chunk, -1 if
+	// unknown.
+	std::array<JumpCommand, MAX_QUEUED_JUMPS> pending_jumps;
+	int32_t pending_jump_count = 0;
+	int32_t jump_check_order = -1;
+	int32_t jump_check_row = -1;
+	int32_t jump_chunk_frames = 0;
+
+	// A note started by `play_note` or stopped by `stop_note`, applied when
+	// `mix` reaches `frame`
+	struct NoteCommand {
+		enum Type {
+			PLAY,
+			STOP
+		};
+
+		Type type = PLAY;
+		int64_t id = 0;
+		// Stream frame, see `frames_rendered_total`
+		uint64_t frame = 0;
+		int32_t instrument = 0;
+		int32_t note = 0;
+		double finetune = 0.0;
+		double volume = 1.0;
+		double panning = 0.0;
+	};
+
+	// A note playing on one of libopenmpt's background channels
+	struct Voice {
+		int64_t id = 0;
+		int32_t channel = -1;
+		// Finetune of the channel after the note started, see `tag_finetune`
+		double finetune = 0.0;
+		// Order in which the voices started
+		uint64_t started = 0;
+	};
+
+	static constexpr int32_t MAX_QUEUED_NOTES = 64;
+	static constexpr int32_t MAX_VOICES = 32;
+
+	// Sent from the main thread and applied by `mix`
+	SPSCQueue<NoteCommand, MAX_QUEUED_NOTES> note_commands;
+	int64_t next_note_id = 1;
+	// Notes sent and not yet applied, bounds `pending_notes`
+	std::atomic<int32_t> queued_note_count{ 0 };
+	// Only accessed by the render thread. `pending_notes` is sorted by frame.
+	std::array<NoteCommand, MAX_QUEUED_NOTES> pending_notes;
+	int32_t pending_note_count = 0;
+	std::array<Voice, MAX_VOICES> voices;
+	uint64_t voices_started = 0;
+
+	// Position and song state sent by `restore_playback_state`. Speed and
+	// tempo are left as they are if 0.
+	struct StateRestore {
+		int32_t order = 0;
+		int32_t row = 0;
+		int32_t speed = 0;
+		double tempo = 0.0;
+		double global_volume = 1.0;
+		int32_t loops = 0;
+		// Seeks here instead of going to `order` and `row` if not negative.
+		// The seek brings back the speed, tempo and global volume itself.
+		double seconds = -1.0;
+	};
+
+	static constexpr int32_t MAX_QUEUED_RESTORES = 4;
+
+	// Sent from the main thread and applied by `mix`. Only the latest one of a
+	// mix is applied.
+	SPSCQueue<StateRestore, MAX_QUEUED_RESTORES> state_restores;
+
+	// Set by `apply_mute_status` when every pattern channel is muted
+	std::atomic<bool> all_channels_muted{ false };
+	// Only accessed by the render thread. Set when the last mix was digital
+	// silence with nothing left to play, so that the next ones can be idle.
+	bool mix_idle = false;
+	// Whether the last `mix` was idle
+	bool last_mix_idle = false;
+
+	// libopenmpt does not expose the current tick so it is estimated from the
+	// frames rendered since the row changed
+	int32_t last_order = -1;
+	int32_t last_row = -1;
+	int64_t frames_in_row = 0;
+	// Estimated from the speed and tempo of the last mix, 0 if unknown
+	double frames_per_tick = 0.0;
+	int64_t frames_per_row = 0;
+	std::atomic<PositionSnapshot> position_snapshot;
+
+	// Covers about 190ms of output when mixed in the resampler's 128-frame
+	// chunks, more than the usual output latency
+	static constexpr size_t POSITION_HISTORY_SIZE = 64;
+	uint64_t frames_rendered_total = 0;
+	SeqlockRing<PositionStamp, POSITION_HISTORY_SIZE> position_history;
+	// Incremented by the main thread for every seek, start and restore. Blocks
+	// rendered before the render thread applied it are not reported anymore.
+	std::atomic<uint32_t> position_generation{ 0 };
+	// Generation of the blocks rendered now, read before the changes are
+	// applied. Render thread only.
+	uint32_t history_generation = 0;
+	// Set while `render_prepared` renders ahead of the playback on a worker.
+	// Positions are not published then, and the command queues are left for
+	// the render thread, their only consumer.
+	bool rendering_ahead = false;
+	// Last restore sent, reported by `save_playback_state` until it is
+	// rendered. Main thread only.
+	StateRestore sent_restore;
+	uint32_t sent_restore_generation = 0;
+	// Generation of the last seek sent, whose `seek_position` is reported by
+	// `save_playback_state` until it is rendered. Main thread only.
+	uint32_t sent_seek_generation = 0;
+
+	enum PrepareState {
+		PREPARE_NONE,
+		PREPARE_PENDING,
+		PREPARE_READY
+	};
+
+	// Rendered ahead of time by `prepare` and handed over to the next playback
+	// that starts from `prepared_position`
+	std::atomic<int32_t> prepare_state{ PREPARE_NONE };
+	int64_t prepare_task_id = -1;
+	double prepared_position = 0.0;
+	std::vector<AudioFrame> prepared_buffer;
+	int32_t prepared_loops = 0;
+	// Position after the prepared buffer, published once a playback played it
+	ModulePosition prepared_end_position;
+	// `module_generation` the prepared buffer was rendered from
+	uint32_t prepared_generation = 0;
+
+	enum ReloadState {
+		RELOAD_NONE,
+		// Parsing on a worker thread
+		RELOAD_PENDING,
+		// Parsed, waiting for the render thread, or the main thread if nothing
+		// plays the stream, to swap the modules
+		RELOAD_READY,
+		// Swapped, waiting for the main thread to swap the tables
+		RELOAD_SWAPPED,
+		RELOAD_FAILED
+	};
+
+	// A module parsed by `reload_from_buffer` into `reloaded_stream`. The
+	// render thread swaps the modules and the old one is freed by the main
+	// thread along with the stream.
+	std::atomic<int32_t> reload_state{ RELOAD_NONE };
+	int64_t reload_task_id = -1;
+	PackedByteArray reload_buffer;
+	String reload_path;
+	Ref<AudioStreamGDMPT> reloaded_stream;
+	// Incremented by every swap
+	std::atomic<uint32_t> module_generation{ 0 };
+
+	// Playbacks between `_start` and `_stop`. Without any, the main thread
+	// swaps a reloaded module itself.
+	std::atomic<int32_t> active_playbacks{ 0 };
+	// Number of `AudioStreamGDMPTLayers` that have this stream as a layer.
+	// Only one can own the module.
+	int32_t layer_owners = 0;
+	// Held while a playback renders the module, so that the main thread does
+	// not swap it in the middle of a mix
+	std::atomic<bool> render_claimed{ false };
+
+	bool has_module() const;
+
+	bool try_claim_render();
+	void release_render();
+
+	// Renders up to `frame_count` frames into `dst_buffer`, restarting the song
+	// if looping is enabled. `loops` is incremented on every restart. Shared by
+	// all playbacks that render this stream's module. With a `rate_divider`,
+	// renders at `SAMPLING_RATE / rate_divider`. `lod_tier` is the lowest
+	// `GovernorTier` the calling playback allows.
+	int32_t mix(AudioFrame *dst_buffer, int32_t frame_count, int32_t &loops, int32_t rate_divider = 1,
+			int32_t lod_tier = GOVERNOR_TIER_FULL);
+
+	// Reapplies `volume_settings` after libopenmpt reset the channels
+	void restore_channel_volumes();
+
+	// Marks `changes` for the render thread
+	void request_changes(uint32_t changes);
+
+	// Applies what the main thread changed since the last mix. Render thread
+	// only.
+	void apply_pending_changes();
+
+	// Seeks the module. Render thread only.
+	void seek_module(double position);
+
+	// Moves the commands sent by `queue_jump` and `cancel_jump` to
+	// `pending_jumps`
+	void process_jump_commands();
+
+	// Applies the first pending jump if the last rendered chunk crossed its
+	// boundary and picks the size of the next chunk
+	void update_pending_jumps();
+
+	// Moves the commands sent by `play_note` and `stop_note` to
+	// `pending_notes`
+	void process_note_commands();
+
+	// Applies the pending notes due at or before `frame`
+	void apply_due_notes(uint64_t frame);
+
+	// Whether the channel of `voice` still plays its note rather than one that
+	// libopenmpt started there for the pattern
+	bool is_voice_on_channel(const Voice &voice) const;
+
+	// Returns a free voice, else one whose channel was taken over, else the
+	// oldest one
+	int32_t allocate_voice() const;
+
+	// Applies the latest state sent by `restore_playback_state`, including
+	// the loop count of the playback
+	void process_state_restores(int32_t &loops);
+
+	// Sends a note command for the frame that is rendered as late after the
+	// last mix as this call is, which keeps the latency of notes constant
+	int64_t send_note_command(NoteCommand &command);
+
+	// Combines `channel_mutes` and `channel_solos` into the mute status that
+	// the render thread applies in one call
+	void apply_mute_status();
+
+	// Updates `mix_idle` from the frames rendered by the last mix
+	void update_mix_idle(const ModulePosition &position, const AudioFrame *buffer, int32_t frame_count);
+
+	// Whether a mix of `frame_count` frames can be idle. Nothing that can
+	// start a sound may be pending and the mix has to end a tick before the
+	// estimated start of the next row.
+	bool can_mix_idle(int32_t frame_count, int32_t rate_divider) const;
+
+	// Outputs `frame_count` frames of silence while advancing the module by as
+	// long at `IDLE_RATE_DIVIDER`. Returns fewer frames at the end of the song.
+	// `heard` is set if the module was not silent after all.
+	int32_t mix_idle_frames(AudioFrame *dst_buffer, int32_t frame_count, int32_t rate_divider, bool &heard);
+
+	// Updates `position_snapshot` after `frames_rendered` frames were rendered
+	// by a playback that looped `loops` times
+	void publish_position(const ModulePosition &position, int64_t frames_rendered, int32_t loops);
+
+	// Makes `find_audible_position` fail until the render thread applied the
+	// seek, start or restore that was just sent. Returns the new generation.
+	// Main thread only.
+	uint32_t invalidate_position_history();
+
+	// Sends a seek to `position` to the next mix. Main thread only.
+	void request_seek(double position);
+
+	// Finds the block that is currently audible, taking the output latency
+	// into account, and the position in seconds within it. Lock-free. Fails if
+	// nothing was rendered since the last seek, start or restore.
+	bool find_audible_position(PositionStamp &stamp, double &seconds) const;
+
+	// Adjusts the tempo factor so that the beats rendered by the module follow
+	// the tempo lock's reference clock
+	void update_tempo_lock(const ModulePosition &position, int32_t frames_rendered);
+
+	// Seeks and renders the prepared buffer. Runs on a `WorkerThreadPool`
+	// thread.
+	void render_prepared();
+
+	// Waits for a pending `prepare` to finish
+	void wait_for_prepare();
+
+	// Parses the reloaded module and positions it where this stream plays.
+	// Runs on a `WorkerThreadPool` thread.
+	void parse_reloaded();
+
+	// Swaps the reloaded module in for `module`. Render thread, or main thread
+	// while no playback is active.
+	void swap_reloaded_module();
+
+	// Takes the tables of the reloaded module, frees the old one and emits
+	// `reloaded`. Main thread only.
+	void finish_reload();
+
+	// Moves the prepared buffer into `buffer` if it was prepared for
+	// `from_pos` from the current module. Returns `false` if the playback has
+	// to seek by itself.
+	bool take_prepared(double from_pos, std::vector<AudioFrame> &buffer, int32_t &loops);
 
-	// Emits the signal. This is called from `AudioStreamGDMPTPlayback` but the
-	// itself has to be emitted by `AudioStreamGDMPT`
+	// Applies the interpolation filter and volume ramping for the requested
+	// filter and the current governor tier
+	void apply_render_quality();
+
+	// Changes the governor tier and queues the signal. Called from
+	// `AudioStreamGDMPTPlayback`.
+	void set_governor_tier(int32_t tier);
+
+	// Creates a stream playing `subsong` of `data`, or the module's default
+	// subsong if negative. libopenmpt does not keep a reference to `data`.
+	static Ref<AudioStreamGDMPT> create_from_data(const PackedByteArray &data, int32_t subsong);
+
+	// Reads the orders, pattern sizes and instrument names into their tables
+	void read_structure();
+
+	// Swaps in the reloaded module unless the main thread is reading patterns
+	// from the current one. Returns whether it swapped.
+	bool try_swap_reloaded_module();
+
+	// Queues the `looped` signal. Called from `AudioStreamGDMPTPlayback` too.
 	void emit_looping_signal();
 
+	// Queues `event` for `dispatch_render_events`. Never blocks or allocates.
+	void push_render_event(const RenderEvent &event);
+
+	// Queues the last OpenMPT error, if any, and returns whether there was one
+	bool report_render_error();
+
+	// Emits the signals and prints the errors queued by the render thread.
+	// Runs on the main thread every frame once a playback was instantiated.
+	void dispatch_render_events();
+
+	// Makes the scene tree call `dispatch_render_events` every frame
+	void connect_render_events() const;
+
 	// Retrieves and clears the last OpenMPT error. Returns a `nullptr` if
 	// there is no error.
 	std::optional<String> pop_last_openmpt_error() const;
@@ -47,11 +538,80 @@ public:
 		SINC_INTERPOLATION = 8
 	};
 
+	// Offsets of the commands of a cell in `get_pattern_data`
+	enum PatternCommand {
+		PATTERN_COMMAND_NOTE = 0,
+		PATTERN_COMMAND_INSTRUMENT = 1,
+		PATTERN_COMMAND_VOLUME_EFFECT = 2,
+		PATTERN_COMMAND_EFFECT = 3,
+		PATTERN_COMMAND_VOLUME = 4,
+		PATTERN_COMMAND_PARAMETER = 5,
+		PATTERN_COMMAND_COUNT = 6
+	};
+
+	// Musical position at which a queued jump is applied
+	enum JumpBoundary {
+		JUMP_BOUNDARY_NEXT_ROW = 0,
+		JUMP_BOUNDARY_NEXT_BEAT = 1,
+		JUMP_BOUNDARY_PATTERN_END = 2
+	};
+
+	// Render quality steps taken by the CPU-budget governor, from the best
+	// quality to the cheapest
+	enum GovernorTier {
+		// Interpolation filter as configured
+		GOVERNOR_TIER_FULL = 0,
+		// At most cubic interpolation
+		GOVERNOR_TIER_CUBIC = 1,
+		// At most linear interpolation
+		GOVERNOR_TIER_LINEAR = 2,
+		// At most linear interpolation and no volume ramping
+		GOVERNOR_TIER_MINIMAL = 3
+	};
+
 	static Ref<AudioStreamGDMPT> load_from_buffer(
 			const PackedByteArray &buffer);
 
 	static Ref<AudioStreamGDMPT> load_from_file(const String &path);
 
+	// Replaces the module while it plays. The bytes are parsed on a worker
+	// thread and the render thread swaps the new module in at the order and
+	// row it reached, keeping the tempo, pitch, filter, channel volumes and
+	// mutes. The position and settings of channels the old module did not have
+	// come from the new one. A stream that is not playing is swapped by the
+	// main thread. `reloaded` is emitted on the frame after the swap or when
+	// parsing failed. Until then the stream reports the old module. A buffer
+	// prepared from the old module is not used.
+	void reload_from_buffer(const PackedByteArray &buffer);
+	void reload_from_file(const String &path);
+	bool is_reloading() const;
+
+	// Creates another stream of the same module playing `subsong`. The module
+	// is parsed again from `buffer`, which streams loaded from a buffer must
+	// pass since their bytes are not kept, or else from the file. The position
+	// and settings are independent.
+	Ref<AudioStreamGDMPT> instantiate_subsong(int32_t subsong, const PackedByteArray &buffer = PackedByteArray()) const;
+
+	// Records loads, seeks, mixes, module lock waits and loops of every
+	// stream. `save_trace` writes the events recorded since tracing was
+	// enabled as a Chrome trace for Perfetto or `chrome://tracing`.
+	static void set_tracing_enabled(bool enable);
+	static bool is_tracing_enabled();
+	static Error save_trace(const String &path);
+
+	// Allocations and module lock acquisitions counted on the audio thread
+	// while rendering, and the callbacks that made any. Only counted by builds
+	// with `GDMPT_REALTIME_CHECKS`, which also print an error for each such
+	// callback.
+	static Dictionary get_realtime_violations();
+
+	// Seeks to `from_pos` and renders the first blocks on a worker thread.
+	// The next playback started from `from_pos` begins by copying them instead
+	// of rendering, which keeps its first callback cheap. Fails while the
+	// stream is playing.
+	void prepare(double from_pos);
+	bool is_prepared() const;
+
 	String get_filename() const;
 
 	void set_loop(bool enable);
@@ -60,32 +620,159 @@ public:
 	void set_tempo_factor(double factor);
 	double get_tempo_factor() const;
 
+	// Continuously adjusts the tempo factor from the render thread so that
+	// the module plays at `bpm` beats per minute, correcting for drift against
+	// the rendered frame count. Overrides `tempo_factor` while enabled; 0
+	// disables the lock.
+	void set_tempo_lock_bpm(double bpm);
+	double get_tempo_lock_bpm() const;
+
+	// Seconds the module is behind the tempo lock's reference clock. Negative
+	// if it is ahead.
+	double get_tempo_lock_drift() const;
+
 	void set_pitch_factor(double factor);
 	double get_pitch_factor() const;
 
 	void set_interpolation_filter(InterpolationFilter filter);
 	InterpolationFilter get_interpolation_filter() const;
 
+	int32_t get_num_orders() const;
+	int32_t get_num_patterns() const;
+	int32_t get_order_pattern(int32_t order) const;
+	int32_t get_pattern_num_rows(int32_t pattern) const;
+
+	// Returns every cell of `pattern` as `PATTERN_COMMAND_COUNT` bytes per
+	// channel, row by row. Read from the module on first access and cached.
+	PackedByteArray get_pattern_data(int32_t pattern) const;
+
+	// Returns the order, row and (estimated) tick that were last rendered
+	// without locking the module
+	Vector3i get_current_position() const;
+
+	// Like `get_current_position` but for what is currently heard, which lags
+	// behind rendering by the output latency. The tick is estimated.
+	Vector3i get_audible_position() const;
+
+	// Snapshot of what is currently heard, for save games: version, subsong,
+	// order, row, tick, speed, tempo, global volume and loop count, and the
+	// tempo, pitch, filter and channel settings of the stream. Can be
+	// serialized with `var_to_bytes`. If a seek was not heard yet, `seconds`
+	// holds its target, which `restore_playback_state` seeks to instead of the
+	// order and row.
+	Dictionary save_playback_state() const;
+
+	// Resumes at the start of the saved row with the saved song state and
+	// settings. Also works before `play` on a fresh or pooled stream of the
+	// same module. The tick and the notes held by the channels are not
+	// restored. The render thread still has libopenmpt seek to the row, which
+	// simulates the song up to there and takes longer further into the song.
+	void restore_playback_state(const Dictionary &state);
+
+	// Queues a jump to `row` of `order`. The render thread applies it at the
+	// first `boundary` after the previously queued jumps were applied, and
+	// `jump_applied` is emitted on the next frame. Returns the id of the jump
+	// or -1 on failure. Jumps must be queued and cancelled from a single
+	// thread.
+	int64_t queue_jump(int32_t order, int32_t row, JumpBoundary boundary);
+	void cancel_jump(int64_t id);
+	void cancel_all_jumps();
+	int32_t get_queued_jump_count() const;
+
+	// Plays `instrument` once as a sampler voice, mixed into the module's
+	// output. `pitch` is in semitones with 60 being C-5; fractions are applied
+	// as finetune, to 1/512 semitone. Notes start sample-accurately with a
+	// constant latency. Free voices are used first, then those whose channel
+	// libopenmpt gave to the pattern, then the oldest one. Returns the id of
+	// the note or -1 on failure. Notes must be played and stopped from a
+	// single thread.
+	int64_t play_note(int32_t instrument, double pitch, double volume = 1.0, double panning = 0.0);
+	void stop_note(int64_t id);
+
+	// Instruments that `play_note` accepts. The samples if the module has no
+	// instruments.
+	int32_t get_num_instruments() const;
+	String get_instrument_name(int32_t instrument) const;
+
+	// Muted channels are skipped by the mixer. If any channel is soloed, every
+	// channel that is not soloed is muted.
+	void set_channel_mute(int32_t channel, bool mute);
+	bool get_channel_mute(int32_t channel) const;
+
+	void set_channel_solo(int32_t channel, bool solo);
+	bool get_channel_solo(int32_t channel) const;
+
+	void set_channel_group(const String &name, const PackedInt32Array &channels);
+	PackedInt32Array get_channel_group(const String &name) const;
+	void remove_channel_group(const String &name);
+	PackedStringArray get_channel_group_names() const;
+
+	// Mutes or solos every channel of the group at once
+	void set_group_mute(const String &name, bool mute);
+	void set_group_solo(const String &name, bool solo);
+
+	// When enabled, the playback lowers the render quality if rendering takes
+	// more than `governor_budget` of the time between audio callbacks
+	void set_governor_enabled(bool enable);
+	bool get_governor_enabled() const;
+
+	void set_governor_budget(double budget);
+	double get_governor_budget() const;
+
+	GovernorTier get_governor_tier() const;
+
+	// Audibility thresholds of the render LOD of playbacks
+	void set_lod_reduced_audibility(double audibility);
+	double get_lod_reduced_audibility() const;
+
+	void set_lod_suspended_audibility(double audibility);
+	double get_lod_suspended_audibility() const;
+
 	int32_t get_num_channels() const;
 
+	// Selecting a subsong restarts the module at its start. `get_subsong_info`
+	// returns the metadata read at load: name, duration, start order and row,
+	// channels, and the initial speed, tempo and BPM.
+	void set_subsong(int32_t subsong);
+	int32_t get_subsong() const;
+	int32_t get_subsong_count() const;
+	Dictionary get_subsong_info(int32_t subsong) const;
+
 	void set_channel_volume(int32_t channel, double volume);
 	double get_channel_volume(int32_t channel) const;
 
 	// Overrides
 
-	virtual Ref<AudioStreamPlayback> _instantiate_playback() const override;
+	virtual Ref<AudioStreamPlayback> _instantiate_playback() const GDMPT_OVERRIDE;
 
-	virtual String _get_stream_name() const override;
+	virtual String _get_stream_name() const GDMPT_OVERRIDE;
 
-	virtual double _get_length() const override;
+	virtual double _get_length() const GDMPT_OVERRIDE;
 
-	virtual bool _is_monophonic() const override;
+	virtual bool _is_monophonic() const GDMPT_OVERRIDE;
 
-	virtual double _get_bpm() const override;
+	virtual double _get_bpm() const GDMPT_OVERRIDE;
 
-	virtual int32_t _get_beat_count() const override;
+	virtual int32_t _get_beat_count() const GDMPT_OVERRIDE;
+
+#ifdef GDMPT_MODULE
+	// Engine overrides
+
+	virtual Ref<AudioStreamPlayback> instantiate_playback() override { return _instantiate_playback(); }
+
+	virtual String get_stream_name() const override { return _get_stream_name(); }
+
+	virtual double get_length() const override { return _get_length(); }
+
+	virtual bool is_monophonic() const override { return _is_monophonic(); }
+
+	virtual double get_bpm() const override { return _get_bpm(); }
+
+	virtual int get_beat_count() const override { return _get_beat_count(); }
+#endif
 
 	AudioStreamGDMPT();
+	~AudioStreamGDMPT();
 };
 
 class AudioStreamGDMPTPlayback : public AudioStreamPlaybackResampled {
@@ -97,32 +784,121 @@ class AudioStreamGDMPTPlayback : public AudioStreamPlaybackResampled {
 	bool active = false;
 	int32_t loops = 0;
 
+	// Taken from `stream` when starting from a prepared position
+	std::vector<AudioFrame> prepared_buffer;
+	size_t prepared_offset = 0;
+	ModulePosition prepared_end_position;
+	uint32_t prepared_generation = 0;
+
+	// Smoothed ratio of render time to callback duration
+	double governor_load = 0.0;
+	// Consecutive callbacks above or below the budget
+	int32_t governor_over_budget = 0;
+	int32_t governor_under_budget = 0;
+
+	// Linear gain at which the player is heard, set by the game
+	std::atomic<double> audibility{ 1.0 };
+	// `RenderLOD` picked after every mix
+	std::atomic<int32_t> target_lod{ 0 };
+	// `RenderLOD` of the rate reported to the resampler, which the next mix
+	// renders at
+	mutable std::atomic<int32_t> render_lod{ 0 };
+
+	std::atomic<uint64_t> idle_mix_count{ 0 };
+	std::atomic<uint64_t> idle_frames_saved{ 0 };
+
+	// Steps the governor tier of `stream` based on how long the last render took
+	void update_governor(uint64_t render_usec, int32_t frame_count);
+
+	// Picks the render LOD from `audibility` and the thresholds of `stream`
+	void update_render_lod();
+
+	// `_mix_resampled` while holding the render claim of `stream`
+	int32_t mix_claimed(AudioFrame *dst_buffer, int32_t frame_count);
+
 protected:
 	static void _bind_methods();
 
 public:
+	// Render level of detail, picked from the audibility
+	enum RenderLOD {
+		// Full sampling rate and quality
+		RENDER_LOD_FULL = 0,
+		// Half the sampling rate and at most linear interpolation, upsampled
+		// by the resampler
+		RENDER_LOD_REDUCED = 1,
+		// Nothing is heard. A quarter of the sampling rate at minimal quality
+		// is still rendered so that the song keeps playing.
+		RENDER_LOD_SUSPENDED = 2
+	};
+
+	// Tells how loud the player is heard, e.g. the attenuation by distance
+	// times its volume. Below the stream's LOD thresholds the playback renders
+	// at a lower rate or not at all.
+	void set_audibility(double audibility);
+	double get_audibility() const;
+
+	RenderLOD get_render_lod() const;
+
+	// Mixes that only advanced the module at the idle rate because it was
+	// silent, and the frames at the rate of the render LOD that were not
+	// rendered because of it
+	int64_t get_idle_mix_count() const;
+	int64_t get_idle_frames_saved() const;
+
 	// Overrides
-	virtual void _start(double from_pos) override;
+	virtual void _start(double from_pos) GDMPT_OVERRIDE;
 
-	virtual void _stop() override;
+	virtual void _stop() GDMPT_OVERRIDE;
 
-	virtual bool _is_playing() const override;
+	virtual bool _is_playing() const GDMPT_OVERRIDE;
 
-	virtual int32_t _get_loop_count() const override;
+	virtual int32_t _get_loop_count() const GDMPT_OVERRIDE;
 
-	virtual double _get_playback_position() const override;
+	// Position that is currently audible, compensated for the output latency.
+	// Does not lock the module.
+	virtual double _get_playback_position() const GDMPT_OVERRIDE;
 
-	virtual void _seek(double position) override;
+	virtual void _seek(double position) GDMPT_OVERRIDE;
 
-	virtual int32_t _mix_resampled(AudioFrame *dst_buffer, int32_t frame_count) override;
+	virtual int32_t _mix_resampled(AudioFrame *dst_buffer, int32_t frame_count) GDMPT_OVERRIDE;
 
-	virtual double _get_stream_sampling_rate() const override;
+	virtual double _get_stream_sampling_rate() const GDMPT_OVERRIDE;
+
+#ifdef GDMPT_MODULE
+	// Engine overrides. The resampler is reset on `start` the same way the
+	// engine's own resampled streams do it.
+
+	virtual void start(double p_from_pos) override {
+		_start(p_from_pos);
+		begin_resample();
+	}
+
+	virtual void stop() override { _stop(); }
+
+	virtual bool is_playing() const override { return _is_playing(); }
+
+	virtual int get_loop_count() const override { return _get_loop_count(); }
+
+	virtual double get_playback_position() const override { return _get_playback_position(); }
+
+	virtual void seek(double p_time) override { _seek(p_time); }
+
+	virtual int _mix_internal(AudioFrame *p_buffer, int p_frames) override { return _mix_resampled(p_buffer, p_frames); }
+
+	virtual float get_stream_sampling_rate() override { return _get_stream_sampling_rate(); }
+#endif
 
 	AudioStreamGDMPTPlayback();
+	~AudioStreamGDMPTPlayback();
 };
 
 } // namespace godot
 
 VARIANT_ENUM_CAST(AudioStreamGDMPT::InterpolationFilter);
+VARIANT_ENUM_CAST(AudioStreamGDMPT::PatternCommand);
+VARIANT_ENUM_CAST(AudioStreamGDMPT::JumpBoundary);
+VARIANT_ENUM_CAST(AudioStreamGDMPT::GovernorTier);
+VARIANT_ENUM_CAST(AudioStreamGDMPTPlayback::RenderLOD);
 
 #endif
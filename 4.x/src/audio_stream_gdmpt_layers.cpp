@@ -0,0 +1,467 @@
+#include "audio_stream_gdmpt_layers.h"
+
+#include "realtime_checks.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace godot;
+
+// Frames per layer allocated with the playback, more than the resampler's
+// 128-frame chunks. Longer requests are mixed in several blocks.
+constexpr int32_t LAYER_BLOCK_FRAMES = 512;
+
+// Blocks rendered ahead of the audio thread when rendering in parallel
+constexpr int32_t MIN_AHEAD_BLOCKS = 3;
+constexpr int32_t MAX_AHEAD_BLOCKS = 32;
+
+int32_t AudioStreamGDMPTLayers::add_layer(const Ref<AudioStreamGDMPT> &stream, float gain) {
+	ERR_FAIL_NULL_V(stream, -1);
+	ERR_FAIL_COND_V_EDMSG(layers.size() >= MAX_LAYERS, -1,
+			"Cannot add more than " + String::num_int64(MAX_LAYERS) + " layers.");
+	// A module can only be at one position at a time
+	ERR_FAIL_COND_V_EDMSG(stream->layer_owners > 0, -1,
+			"Stream was already added as a layer.");
+	ERR_FAIL_COND_V_EDMSG(stream->active_playbacks.load(std::memory_order_acquire) > 0, -1,
+			"Cannot add a stream that is playing as a layer.");
+
+	stream->layer_owners++;
+	Layer layer;
+	layer.stream = stream;
+	layer.gain = std::make_shared<std::atomic<float>>(gain);
+	layers.push_back(layer);
+	return static_cast<int32_t>(layers.size()) - 1;
+}
+
+void AudioStreamGDMPTLayers::remove_layer(int32_t index) {
+	ERR_FAIL_INDEX(index, static_cast<int32_t>(layers.size()));
+
+	layers[index].stream->layer_owners--;
+	layers.erase(layers.begin() + index);
+}
+
+void AudioStreamGDMPTLayers::clear_layers() {
+	for (const auto &layer : layers) {
+		layer.stream->layer_owners--;
+	}
+	layers.clear();
+}
+
+int32_t AudioStreamGDMPTLayers::get_layer_count() const {
+	return static_cast<int32_t>(layers.size());
+}
+
+Ref<AudioStreamGDMPT> AudioStreamGDMPTLayers::get_layer_stream(int32_t index) const {
+	ERR_FAIL_INDEX_V(index, static_cast<int32_t>(layers.size()), nullptr);
+
+	return layers[index].stream;
+}
+
+void AudioStreamGDMPTLayers::set_layer_gain(int32_t index, float gain) {
+	ERR_FAIL_INDEX(index, static_cast<int32_t>(layers.size()));
+
+	layers[index].gain->store(gain, std::memory_order_relaxed);
+}
+
+float AudioStreamGDMPTLayers::get_layer_gain(int32_t index) const {
+	ERR_FAIL_INDEX_V(index, static_cast<int32_t>(layers.size()), 0.0f);
+
+	return layers[index].gain->load(std::memory_order_relaxed);
+}
+
+void AudioStreamGDMPTLayers::set_parallel_threshold(int32_t threshold) {
+	parallel_threshold = threshold;
+}
+
+int32_t AudioStreamGDMPTLayers::get_parallel_threshold() const {
+	return parallel_threshold;
+}
+
+void AudioStreamGDMPTLayers::set_parallel_cost_ratio(double ratio) {
+	parallel_cost_ratio = ratio;
+}
+
+double AudioStreamGDMPTLayers::get_parallel_cost_ratio() const {
+	return parallel_cost_ratio;
+}
+
+Ref<AudioStreamPlayback> AudioStreamGDMPTLayers::_instantiate_playback() const {
+	ERR_FAIL_COND_V(layers.empty(), nullptr);
+
+	Ref<AudioStreamGDMPTLayersPlayback> playback;
+	playback.instantiate();
+
+	playback->stream = Ref<AudioStreamGDMPTLayers>(this);
+	playback->active = false;
+	for (const auto &layer : layers) {
+		ERR_FAIL_COND_V(!layer.stream->has_module(), nullptr);
+
+		AudioStreamGDMPTLayersPlayback::LayerState state;
+		state.stream = layer.stream;
+		state.gain = layer.gain;
+		playback->layers.push_back(state);
+		layer.stream->connect_render_events();
+	}
+	playback->layer_buffer_frames = LAYER_BLOCK_FRAMES;
+	playback->layer_buffer.resize(layers.size() * LAYER_BLOCK_FRAMES);
+	playback->parallel_threshold = parallel_threshold;
+	playback->parallel_cost_ratio = parallel_cost_ratio;
+	if (parallel_threshold > 0 && layers.size() > 1) {
+		// Two server buffers and the block being played, so that the next
+		// buffer is rendered while the current one is heard
+		double latency_frames = AudioServer::get_singleton()->get_output_latency() * SAMPLING_RATE;
+		auto latency_blocks = static_cast<int32_t>(std::ceil(latency_frames / LAYER_BLOCK_FRAMES));
+		playback->ahead_target = std::clamp(latency_blocks * 2 + 1, MIN_AHEAD_BLOCKS, MAX_AHEAD_BLOCKS);
+		playback->ahead_blocks.resize(playback->ahead_target * 2);
+		playback->ahead_buffer.resize(playback->ahead_blocks.size() * LAYER_BLOCK_FRAMES);
+	}
+
+	return playback;
+}
+
+String AudioStreamGDMPTLayers::_get_stream_name() const { return ""; }
+
+double AudioStreamGDMPTLayers::_get_length() const {
+	double length = 0.0;
+	for (const auto &layer : layers) {
+		length = std::max(length, layer.stream->_get_length());
+	}
+	return length;
+}
+
+bool AudioStreamGDMPTLayers::_is_monophonic() const {
+	// `AudioStreamGDMPT` is stereo
+	return false;
+}
+
+double AudioStreamGDMPTLayers::_get_bpm() const {
+	// The first layer is assumed to drive the tempo
+	ERR_FAIL_COND_V(layers.empty(), 0.0);
+
+	return layers[0].stream->_get_bpm();
+}
+
+int32_t AudioStreamGDMPTLayers::_get_beat_count() const {
+	// Unsupported
+	return 0;
+}
+
+void AudioStreamGDMPTLayers::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("add_layer", "stream", "gain"),
+			&AudioStreamGDMPTLayers::add_layer, DEFVAL(1.0f));
+	ClassDB::bind_method(D_METHOD("remove_layer", "index"),
+			&AudioStreamGDMPTLayers::remove_layer);
+	ClassDB::bind_method(D_METHOD("clear_layers"),
+			&AudioStreamGDMPTLayers::clear_layers);
+
+	ClassDB::bind_method(D_METHOD("get_layer_count"),
+			&AudioStreamGDMPTLayers::get_layer_count);
+	ClassDB::bind_method(D_METHOD("get_layer_stream", "index"),
+			&AudioStreamGDMPTLayers::get_layer_stream);
+
+	ClassDB::bind_method(D_METHOD("set_layer_gain", "index", "gain"),
+			&AudioStreamGDMPTLayers::set_layer_gain);
+	ClassDB::bind_method(D_METHOD("get_layer_gain", "index"),
+			&AudioStreamGDMPTLayers::get_layer_gain);
+
+	ClassDB::bind_method(D_METHOD("set_parallel_threshold", "threshold"),
+			&AudioStreamGDMPTLayers::set_parallel_threshold);
+	ClassDB::bind_method(D_METHOD("get_parallel_threshold"),
+			&AudioStreamGDMPTLayers::get_parallel_threshold);
+
+	ClassDB::bind_method(D_METHOD("set_parallel_cost_ratio", "ratio"),
+			&AudioStreamGDMPTLayers::set_parallel_cost_ratio);
+	ClassDB::bind_method(D_METHOD("get_parallel_cost_ratio"),
+			&AudioStreamGDMPTLayers::get_parallel_cost_ratio);
+
+	ADD_PROPERTY(PropertyInfo(Variant::INT, "parallel_threshold"), "set_parallel_threshold", "get_parallel_threshold");
+	ADD_PROPERTY(PropertyInfo(Variant::FLOAT, "parallel_cost_ratio"), "set_parallel_cost_ratio", "get_parallel_cost_ratio");
+}
+
+AudioStreamGDMPTLayers::AudioStreamGDMPTLayers() {}
+
+AudioStreamGDMPTLayers::~AudioStreamGDMPTLayers() {
+	clear_layers();
+}
+
+////////////////
+
+void AudioStreamGDMPTLayersPlayback::render_layer(uint32_t index) {
+	GDMPT_TRACE_SCOPE("mix_layer");
+	// Also covers the worker threads that render layers in parallel
+	RealtimeScope realtime_scope;
+
+	auto &layer = layers[index];
+	auto dst_buffer = layer_buffer.data() + index * layer_buffer_frames;
+
+	if (!layer.stream->try_claim_render()) {
+		// The main thread is swapping a reloaded module
+		std::fill_n(dst_buffer, block_frames, AudioFrame(0.0f, 0.0f));
+		layer.frames_rendered = block_frames;
+		layer.render_usec = 0;
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	layer.frames_rendered = layer.stream->mix(dst_buffer, block_frames, layer.loops);
+	auto end = std::chrono::steady_clock::now();
+	layer.stream->release_render();
+
+	layer.render_usec = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+void AudioStreamGDMPTLayersPlayback::_start(double from_pos) {
+	if (!active) {
+		for (const auto &layer : layers) {
+			layer.stream->active_playbacks.fetch_add(1, std::memory_order_acq_rel);
+		}
+	}
+	active = true;
+	_seek(from_pos);
+
+	if (is_rendering_ahead() && !ahead_thread.joinable()) {
+		ahead_running.store(true, std::memory_order_release);
+		ahead_thread = std::thread(&AudioStreamGDMPTLayersPlayback::render_ahead, this);
+	}
+}
+
+void AudioStreamGDMPTLayersPlayback::_stop() {
+	// Renders the layers as long as it runs
+	stop_render_ahead();
+	if (active) {
+		for (const auto &layer : layers) {
+			layer.stream->active_playbacks.fetch_sub(1, std::memory_order_acq_rel);
+		}
+	}
+	active = false;
+}
+
+bool AudioStreamGDMPTLayersPlayback::_is_playing() const { return active; }
+
+int32_t AudioStreamGDMPTLayersPlayback::_get_loop_count() const {
+	ERR_FAIL_COND_V(layers.empty(), 0);
+
+	return layers[0].loops;
+}
+
+double AudioStreamGDMPTLayersPlayback::_get_playback_position() const {
+	ERR_FAIL_COND_V(layers.empty(), 0.0);
+
+	const auto &layer_stream = layers[0].stream;
+	PositionStamp stamp;
+	double seconds;
+	if (layer_stream->find_audible_position(stamp, seconds)) {
+		// The layers were rendered ahead of what the audio thread played
+		auto queued = ahead_written.load(std::memory_order_acquire) - ahead_read.load(std::memory_order_acquire);
+		return std::max(seconds - queued * layer_buffer_frames / SAMPLING_RATE, 0.0);
+	}
+
+	// Nothing was rendered since the last seek or start
+	return layer_stream->seek_position.load(std::memory_order_relaxed);
+}
+
+void AudioStreamGDMPTLayersPlayback::_seek(double position) {
+	// Not in the middle of a block rendered ahead, which would hold both
+	// positions
+	const std::lock_guard<std::mutex> lock(ahead_mutex);
+
+	// Applied by the next mix of each layer
+	for (const auto &layer : layers) {
+		layer.stream->request_seek(position);
+	}
+	// The blocks rendered ahead before are dropped
+	seek_generation.fetch_add(1, std::memory_order_release);
+}
+
+int32_t AudioStreamGDMPTLayersPlayback::_mix_resampled(AudioFrame *dst_buffer,
+		int32_t frame_count) {
+	GDMPT_TRACE_SCOPE("mix");
+	RealtimeScope realtime_scope;
+
+	ERR_FAIL_NULL_V(stream, 0);
+	ERR_FAIL_COND_V(layers.empty(), 0);
+
+	if (is_rendering_ahead()) {
+		return mix_ahead(dst_buffer, frame_count);
+	}
+
+	int32_t total_mixed = 0;
+	while (total_mixed < frame_count) {
+		auto frames_to_mix = std::min(frame_count - total_mixed, layer_buffer_frames);
+		auto frames_mixed = render_block(dst_buffer + total_mixed, frames_to_mix);
+		total_mixed += frames_mixed;
+		if (frames_mixed < frames_to_mix) {
+			// All layers ended
+			break;
+		}
+	}
+	return total_mixed;
+}
+
+int32_t AudioStreamGDMPTLayersPlayback::mix_ahead(AudioFrame *dst_buffer, int32_t frame_count) {
+	int32_t frames_mixed = 0;
+	while (frames_mixed < frame_count) {
+		auto read = ahead_read.load(std::memory_order_relaxed);
+		bool ready = read != ahead_written.load(std::memory_order_acquire);
+		// Loaded after the block, so never older than its generation
+		auto generation = seek_generation.load(std::memory_order_acquire);
+		if (generation != played_generation) {
+			// The layers play again from the seek position
+			played_generation = generation;
+			ahead_ended = false;
+		}
+		if (ahead_ended) {
+			break;
+		}
+		if (!ready) {
+			// Waiting would hold up the audio thread
+			std::fill_n(dst_buffer + frames_mixed, frame_count - frames_mixed, AudioFrame(0.0f, 0.0f));
+			late_block_count.fetch_add(1, std::memory_order_relaxed);
+			return frame_count;
+		}
+
+		auto slot = read % ahead_blocks.size();
+		const auto &block = ahead_blocks[slot];
+		if (block.generation == generation) {
+			auto frames = std::min(frame_count - frames_mixed, block.frames - ahead_offset);
+			std::copy_n(ahead_buffer.data() + slot * layer_buffer_frames + ahead_offset, frames,
+					dst_buffer + frames_mixed);
+			frames_mixed += frames;
+			ahead_offset += frames;
+			if (ahead_offset < block.frames) {
+				continue;
+			}
+			ahead_ended = block.frames < layer_buffer_frames;
+		}
+		// Played, or rendered before the last seek
+		ahead_offset = 0;
+		ahead_read.store(read + 1, std::memory_order_release);
+	}
+	return frames_mixed;
+}
+
+void AudioStreamGDMPTLayersPlayback::render_ahead() {
+	// Sleeps for a quarter of a block when the ring is full
+	auto idle_time = std::chrono::microseconds(static_cast<int64_t>(layer_buffer_frames / SAMPLING_RATE * 250000.0));
+	uint32_t generation = 0;
+	uint64_t generation_start = 0;
+	bool ended = false;
+	while (ahead_running.load(std::memory_order_acquire)) {
+		bool rendered = false;
+		{
+			const std::lock_guard<std::mutex> lock(ahead_mutex);
+			auto written = ahead_written.load(std::memory_order_relaxed);
+			auto current_generation = seek_generation.load(std::memory_order_relaxed);
+			if (current_generation != generation) {
+				generation = current_generation;
+				generation_start = written;
+				ended = false;
+			}
+
+			auto read = ahead_read.load(std::memory_order_acquire);
+			auto queued = written - std::max(read, generation_start);
+			if (!ended && queued < static_cast<uint64_t>(ahead_target) && written - read < ahead_blocks.size()) {
+				ended = render_ahead_block(generation) < layer_buffer_frames;
+				rendered = true;
+			}
+		}
+		if (!rendered) {
+			std::this_thread::sleep_for(idle_time);
+		}
+	}
+}
+
+int32_t AudioStreamGDMPTLayersPlayback::render_ahead_block(uint32_t generation) {
+	GDMPT_TRACE_SCOPE("render_ahead");
+
+	// Fan out when there are many layers or when rendering them one after the
+	// other took a significant part of the block
+	auto layer_count = static_cast<int32_t>(layers.size());
+	double block_usec = layer_buffer_frames / SAMPLING_RATE * 1000000.0;
+	block_frames = layer_buffer_frames;
+	if (layer_count >= parallel_threshold || last_render_usec > parallel_cost_ratio * block_usec) {
+		auto pool = WorkerThreadPool::get_singleton();
+		auto task_id = pool->add_group_task(
+				callable_mp(this, &AudioStreamGDMPTLayersPlayback::render_layer),
+				layer_count,
+				-1,
+				true,
+				"AudioStreamGDMPTLayers");
+		pool->wait_for_group_task_completion(task_id);
+	} else {
+		for (int32_t i = 0; i < layer_count; i++) {
+			render_layer(i);
+		}
+	}
+
+	auto written = ahead_written.load(std::memory_order_relaxed);
+	auto slot = written % ahead_blocks.size();
+	auto &block = ahead_blocks[slot];
+	block.frames = sum_layers(ahead_buffer.data() + slot * layer_buffer_frames, block_frames);
+	block.generation = generation;
+	ahead_written.store(written + 1, std::memory_order_release);
+	return block.frames;
+}
+
+void AudioStreamGDMPTLayersPlayback::stop_render_ahead() {
+	if (ahead_thread.joinable()) {
+		ahead_running.store(false, std::memory_order_release);
+		ahead_thread.join();
+	}
+}
+
+int32_t AudioStreamGDMPTLayersPlayback::render_block(AudioFrame *dst_buffer, int32_t frame_count) {
+	block_frames = frame_count;
+	for (uint32_t i = 0; i < layers.size(); i++) {
+		render_layer(i);
+	}
+	return sum_layers(dst_buffer, frame_count);
+}
+
+int32_t AudioStreamGDMPTLayersPlayback::sum_layers(AudioFrame *dst_buffer, int32_t frame_count) {
+	for (int32_t i = 0; i < frame_count; i++) {
+		dst_buffer[i].left = 0.0f;
+		dst_buffer[i].right = 0.0f;
+	}
+
+	int32_t total_rendered = 0;
+	last_render_usec = 0;
+	for (size_t i = 0; i < layers.size(); i++) {
+		const auto &layer = layers[i];
+		auto gain = layer.gain->load(std::memory_order_relaxed);
+		auto src_buffer = layer_buffer.data() + i * layer_buffer_frames;
+
+		for (int32_t j = 0; j < layer.frames_rendered; j++) {
+			dst_buffer[j].left += src_buffer[j].left * gain;
+			dst_buffer[j].right += src_buffer[j].right * gain;
+		}
+
+		// A layer that has ended stops contributing but the others keep going
+		total_rendered = std::max(total_rendered, layer.frames_rendered);
+		last_render_usec += layer.render_usec;
+	}
+	return total_rendered;
+}
+
+int64_t AudioStreamGDMPTLayersPlayback::get_late_block_count() const {
+	return static_cast<int64_t>(late_block_count.load(std::memory_order_relaxed));
+}
+
+double AudioStreamGDMPTLayersPlayback::_get_stream_sampling_rate() const {
+	return SAMPLING_RATE;
+}
+
+void AudioStreamGDMPTLayersPlayback::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("get_late_block_count"),
+			&AudioStreamGDMPTLayersPlayback::get_late_block_count);
+}
+
+AudioStreamGDMPTLayersPlayback::AudioStreamGDMPTLayersPlayback() {}
+
+AudioStreamGDMPTLayersPlayback::~AudioStreamGDMPTLayersPlayback() {
+	// Playbacks can be freed without being stopped
+	_stop();
+}
+
+////////////////
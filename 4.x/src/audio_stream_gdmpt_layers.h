@@ -0,0 +1,247 @@
+#ifndef AUDIO_STREAM_GDMPT_LAYERS_H
+#define AUDIO_STREAM_GDMPT_LAYERS_H
+
+#include "audio_stream_gdmpt.h"
+#include "godot_compat.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace godot {
+
+// Plays several `AudioStreamGDMPT` at once from a single playback. The layers
+// are rendered in the same `_mix_resampled` call and summed with their gain.
+// When rendered in parallel, a thread of the playback renders the layers ahead
+// and the audio thread only copies the blocks it finished.
+class AudioStreamGDMPTLayers : public AudioStream {
+	GDCLASS(AudioStreamGDMPTLayers, AudioStream)
+
+	friend class AudioStreamGDMPTLayersPlayback;
+
+	static constexpr int32_t MAX_LAYERS = 16;
+
+	struct Layer {
+		Ref<AudioStreamGDMPT> stream;
+		// Shared with the playbacks so that the gain can be changed while they
+		// are reading it, even after the layer was removed
+		std::shared_ptr<std::atomic<float>> gain;
+	};
+
+	std::vector<Layer> layers;
+	int32_t parallel_threshold = 0;
+	double parallel_cost_ratio = 0.25;
+
+protected:
+	static void _bind_methods();
+
+public:
+	// Returns the index of the new layer or -1 on failure, e.g. if `stream` is
+	// playing or a layer of another `AudioStreamGDMPTLayers`. Changing the
+	// layers only affects playbacks that are instantiated afterwards.
+	int32_t add_layer(const Ref<AudioStreamGDMPT> &stream, float gain = 1.0f);
+	void remove_layer(int32_t index);
+	void clear_layers();
+
+	int32_t get_layer_count() const;
+	Ref<AudioStreamGDMPT> get_layer_stream(int32_t index) const;
+
+	void set_layer_gain(int32_t index, float gain);
+	float get_layer_gain(int32_t index) const;
+
+	// Number of layers at which rendering is spread across `WorkerThreadPool`.
+	// With 0, the layers are rendered one after the other on the audio thread.
+	// Otherwise they are rendered ahead on a thread of each playback and heard
+	// a few blocks later. Only affects playbacks started afterwards.
+	void set_parallel_threshold(int32_t threshold);
+	int32_t get_parallel_threshold() const;
+
+	// Fraction of a block's duration that the layers can take to render one
+	// after the other before rendering is spread across `WorkerThreadPool`.
+	// Only used when `parallel_threshold` is not 0.
+	void set_parallel_cost_ratio(double ratio);
+	double get_parallel_cost_ratio() const;
+
+	// Overrides
+
+	virtual Ref<AudioStreamPlayback> _instantiate_playback() const GDMPT_OVERRIDE;
+
+	virtual String _get_stream_name() const GDMPT_OVERRIDE;
+
+	virtual double _get_length() const GDMPT_OVERRIDE;
+
+	virtual bool _is_monophonic() const GDMPT_OVERRIDE;
+
+	virtual double _get_bpm() const GDMPT_OVERRIDE;
+
+	virtual int32_t _get_beat_count() const GDMPT_OVERRIDE;
+
+#ifdef GDMPT_MODULE
+	// Engine overrides
+
+	virtual Ref<AudioStreamPlayback> instantiate_playback() override { return _instantiate_playback(); }
+
+	virtual String get_stream_name() const override { return _get_stream_name(); }
+
+	virtual double get_length() const override { return _get_length(); }
+
+	virtual bool is_monophonic() const override { return _is_monophonic(); }
+
+	virtual double get_bpm() const override { return _get_bpm(); }
+
+	virtual int get_beat_count() const override { return _get_beat_count(); }
+#endif
+
+	AudioStreamGDMPTLayers();
+	~AudioStreamGDMPTLayers();
+};
+
+class AudioStreamGDMPTLayersPlayback : public AudioStreamPlaybackResampled {
+	GDCLASS(AudioStreamGDMPTLayersPlayback, AudioStreamPlaybackResampled);
+
+	friend class AudioStreamGDMPTLayers;
+
+	struct LayerState {
+		Ref<AudioStreamGDMPT> stream;
+		std::shared_ptr<std::atomic<float>> gain;
+		int32_t loops = 0;
+		int32_t frames_rendered = 0;
+		uint64_t render_usec = 0;
+	};
+
+	Ref<AudioStreamGDMPTLayers> stream;
+	std::vector<LayerState> layers;
+	// One block of `layer_buffer_frames` frames per layer
+	std::vector<AudioFrame> layer_buffer;
+	int32_t layer_buffer_frames = 0;
+	// Number of frames of the block being rendered
+	int32_t block_frames = 0;
+	// Sequential cost of the layers rendered in the last block
+	uint64_t last_render_usec = 0;
+	bool active = false;
+	// Copied from `stream` when instantiated, read by `ahead_thread`
+	int32_t parallel_threshold = 0;
+	double parallel_cost_ratio = 0.0;
+
+	struct AheadBlock {
+		int32_t frames = 0;
+		// `seek_generation` the block was rendered in
+		uint32_t generation = 0;
+	};
+
+	// Ring of blocks summed by `ahead_thread` and played by the audio thread,
+	// `layer_buffer_frames` frames each. Empty when rendering on the audio
+	// thread.
+	std::vector<AudioFrame> ahead_buffer;
+	std::vector<AheadBlock> ahead_blocks;
+	// Blocks written and read since the start. Each is only written by one
+	// side, so neither waits for the other.
+	std::atomic<uint64_t> ahead_written{ 0 };
+	std::atomic<uint64_t> ahead_read{ 0 };
+	// Frames of the block at `ahead_read` that were played. Audio thread only.
+	int32_t ahead_offset = 0;
+	// Set once the block where all layers ended was played, until the next
+	// seek. Audio thread only.
+	bool ahead_ended = false;
+	uint32_t played_generation = 0;
+	// Blocks since the last seek that `ahead_thread` keeps rendered, more than
+	// a server buffer. The ring holds twice as many for the older blocks that
+	// were not dropped yet.
+	int32_t ahead_target = 0;
+	// Increased by every seek. Blocks of an older generation are dropped.
+	std::atomic<uint32_t> seek_generation{ 0 };
+	// Held by `ahead_thread` while rendering a block so that a seek is never
+	// requested in the middle of one. Never taken by the audio thread.
+	std::mutex ahead_mutex;
+	std::thread ahead_thread;
+	std::atomic<bool> ahead_running{ false };
+	// Callbacks that played silence because the layers were not rendered in
+	// time
+	std::atomic<uint64_t> late_block_count{ 0 };
+
+	// Renders the layer at `index` into its block in `layer_buffer`. Called
+	// from `WorkerThreadPool` threads when rendering in parallel.
+	void render_layer(uint32_t index);
+
+	bool is_rendering_ahead() const { return !ahead_blocks.empty(); }
+
+	// Renders all layers on the calling thread and sums them into
+	// `dst_buffer`
+	int32_t render_block(AudioFrame *dst_buffer, int32_t frame_count);
+
+	// Sums the layers in `layer_buffer` into `dst_buffer`
+	int32_t sum_layers(AudioFrame *dst_buffer, int32_t frame_count);
+
+	// Copies up to `frame_count` frames from the blocks rendered ahead. Plays
+	// silence instead of waiting for blocks that are not ready.
+	int32_t mix_ahead(AudioFrame *dst_buffer, int32_t frame_count);
+
+	// Body of `ahead_thread`. Keeps `ahead_target` blocks rendered until the
+	// playback stops.
+	void render_ahead();
+
+	// Renders the next block into the ring, spreading the layers across
+	// `WorkerThreadPool` when there are many or they are slow. Returns the
+	// number of frames rendered, fewer than a block once all layers ended.
+	int32_t render_ahead_block(uint32_t generation);
+
+	// Stops `ahead_thread`. Not for the audio thread.
+	void stop_render_ahead();
+
+protected:
+	static void _bind_methods();
+
+public:
+	// Overrides
+	virtual void _start(double from_pos) GDMPT_OVERRIDE;
+
+	virtual void _stop() GDMPT_OVERRIDE;
+
+	virtual bool _is_playing() const GDMPT_OVERRIDE;
+
+	virtual int32_t _get_loop_count() const GDMPT_OVERRIDE;
+
+	virtual double _get_playback_position() const GDMPT_OVERRIDE;
+
+	virtual void _seek(double position) GDMPT_OVERRIDE;
+
+	virtual int32_t _mix_resampled(AudioFrame *dst_buffer, int32_t frame_count) GDMPT_OVERRIDE;
+
+	virtual double _get_stream_sampling_rate() const GDMPT_OVERRIDE;
+
+	// Number of callbacks that played silence because the layers rendered
+	// ahead were not ready
+	int64_t get_late_block_count() const;
+
+#ifdef GDMPT_MODULE
+	// Engine overrides
+
+	virtual void start(double p_from_pos) override {
+		_start(p_from_pos);
+		begin_resample();
+	}
+
+	virtual void stop() override { _stop(); }
+
+	virtual bool is_playing() const override { return _is_playing(); }
+
+	virtual int get_loop_count() const override { return _get_loop_count(); }
+
+	virtual double get_playback_position() const override { return _get_playback_position(); }
+
+	virtual void seek(double p_time) override { _seek(p_time); }
+
+	virtual int _mix_internal(AudioFrame *p_buffer, int p_frames) override { return _mix_resampled(p_buffer, p_frames); }
+
+	virtual float get_stream_sampling_rate() override { return _get_stream_sampling_rate(); }
+#endif
+
+	AudioStreamGDMPTLayersPlayback();
+	~AudioStreamGDMPTLayersPlayback();
+};
+
+} // namespace godot
+
+#endif
@@ -0,0 +1,14 @@
+#include "content_hash.h"
+
+uint64_t hash_content(const void *data, size_t size) {
+	constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325;
+	constexpr uint64_t FNV_PRIME = 0x100000001b3;
+
+	auto bytes = static_cast<const uint8_t *>(data);
+	uint64_t hash = FNV_OFFSET_BASIS;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
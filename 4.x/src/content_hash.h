@@ -0,0 +1,10 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a of `data`, used to tell whether a file changed
+uint64_t hash_content(const void *data, size_t size);
+
+#endif
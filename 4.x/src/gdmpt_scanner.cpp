@@ -0,0 +1,181 @@
+#include "gdmpt_scanner.h"
+
+#include "content_hash.h"
+
+#include <algorithm>
+
+using namespace godot;
+
+// Bumped whenever the layout of the index changes
+constexpr int64_t INDEX_VERSION = 1;
+
+void GDMPTScanner::scan_file(uint32_t index) {
+	auto &task = tasks[index];
+	auto &entry = task.entry;
+
+	auto file = FileAccess::open(task.path, FileAccess::READ);
+	if (file.is_null()) {
+		task.result = SCAN_RESULT_FAILED;
+		return;
+	}
+	entry.size = file->get_length();
+	entry.modified_time = FileAccess::get_modified_time(task.path);
+
+	if (task.has_previous &&
+			task.previous.size == entry.size &&
+			task.previous.modified_time == entry.modified_time) {
+		entry = task.previous;
+		task.result = SCAN_RESULT_REUSED;
+		return;
+	}
+
+	// Only the start of the file is needed to reject most non-modules
+	auto header_size = std::min(static_cast<uint64_t>(get_probe_header_size()), entry.size);
+	auto data = file->get_buffer(static_cast<int64_t>(header_size));
+	if (!probe_module_header(data.ptr(), static_cast<size_t>(data.size()), entry.size)) {
+		task.result = SCAN_RESULT_REJECTED;
+		return;
+	}
+
+	data.append_array(file->get_buffer(static_cast<int64_t>(entry.size - header_size)));
+	entry.hash = hash_content(data.ptr(), static_cast<size_t>(data.size()));
+
+	// Touched but unchanged
+	if (task.has_previous && task.previous.size == entry.size && task.previous.hash == entry.hash) {
+		entry.is_module = task.previous.is_module;
+		entry.metadata = task.previous.metadata;
+		task.result = SCAN_RESULT_REUSED;
+		return;
+	}
+
+	entry.is_module = read_module_metadata(data.ptr(), static_cast<size_t>(data.size()), entry.metadata);
+	task.result = SCAN_RESULT_LOADED;
+}
+
+Dictionary GDMPTScanner::entry_to_dictionary(const Entry &entry) {
+	Dictionary dict;
+	dict["size"] = static_cast<int64_t>(entry.size);
+	dict["modified_time"] = static_cast<int64_t>(entry.modified_time);
+	// JSON numbers are doubles and would lose precision
+	dict["hash"] = String::num_int64(static_cast<int64_t>(entry.hash));
+	dict["module"] = entry.is_module;
+	if (entry.is_module) {
+		dict["metadata"] = metadata_to_dictionary("", entry.metadata);
+	}
+	return dict;
+}
+
+GDMPTScanner::Entry GDMPTScanner::entry_from_dictionary(const Dictionary &dict) {
+	Entry entry;
+	entry.size = static_cast<uint64_t>(static_cast<int64_t>(dict.get("size", 0)));
+	entry.modified_time = static_cast<uint64_t>(static_cast<int64_t>(dict.get("modified_time", 0)));
+	entry.hash = static_cast<uint64_t>(String(dict.get("hash", "0")).to_int());
+	entry.is_module = dict.get("module", false);
+
+	if (entry.is_module) {
+		Dictionary metadata = dict.get("metadata", Dictionary());
+		entry.metadata.title = String(metadata.get("title", "")).utf8().get_data();
+		entry.metadata.artist = String(metadata.get("artist", "")).utf8().get_data();
+		entry.metadata.format = String(metadata.get("format", "")).utf8().get_data();
+		entry.metadata.format_name = String(metadata.get("format_name", "")).utf8().get_data();
+		entry.metadata.duration_seconds = metadata.get("duration", 0.0);
+		entry.metadata.num_channels = static_cast<int64_t>(metadata.get("channels", 0));
+		entry.metadata.num_subsongs = static_cast<int64_t>(metadata.get("subsongs", 0));
+	}
+	return entry;
+}
+
+Dictionary GDMPTScanner::metadata_to_dictionary(const String &path, const ModuleMetadata &metadata) {
+	Dictionary dict;
+	if (!path.is_empty()) {
+		dict["path"] = path;
+	}
+	dict["title"] = String::utf8(metadata.title.c_str());
+	dict["artist"] = String::utf8(metadata.artist.c_str());
+	dict["format"] = String::utf8(metadata.format.c_str());
+	dict["format_name"] = String::utf8(metadata.format_name.c_str());
+	dict["duration"] = metadata.duration_seconds;
+	dict["channels"] = metadata.num_channels;
+	dict["subsongs"] = metadata.num_subsongs;
+	return dict;
+}
+
+Array GDMPTScanner::scan(const PackedStringArray &paths, const String &index_path) {
+	Dictionary index;
+	if (!index_path.is_empty() && FileAccess::file_exists(index_path)) {
+		Dictionary contents = JSON::parse_string(FileAccess::get_file_as_string(index_path));
+		if (static_cast<int64_t>(contents.get("version", 0)) == INDEX_VERSION) {
+			index = contents.get("files", Dictionary());
+		} else {
+			WARN_PRINT("Ignoring outdated or unreadable module index '" + index_path + "'.");
+		}
+	}
+
+	tasks.clear();
+	tasks.resize(paths.size());
+	for (int64_t i = 0; i < paths.size(); i++) {
+		auto &task = tasks[i];
+		task.path = paths[i];
+		if (index.has(task.path)) {
+			task.previous = entry_from_dictionary(index[task.path]);
+			task.has_previous = true;
+		}
+	}
+
+	if (!tasks.empty()) {
+		auto pool = WorkerThreadPool::get_singleton();
+		auto task_id = pool->add_group_task(
+				callable_mp(this, &GDMPTScanner::scan_file),
+				static_cast<int>(tasks.size()),
+				-1,
+				false,
+				"GDMPTScanner");
+		pool->wait_for_group_task_completion(task_id);
+	}
+
+	Array modules;
+	Dictionary files;
+	int64_t counts[SCAN_RESULT_LOADED + 1] = {};
+	for (const auto &task : tasks) {
+		counts[task.result]++;
+		if (task.result == SCAN_RESULT_FAILED) {
+			continue;
+		}
+		files[task.path] = entry_to_dictionary(task.entry);
+		if (task.entry.is_module) {
+			modules.push_back(metadata_to_dictionary(task.path, task.entry.metadata));
+		}
+	}
+
+	last_scan_stats = Dictionary();
+	last_scan_stats["failed"] = counts[SCAN_RESULT_FAILED];
+	last_scan_stats["rejected"] = counts[SCAN_RESULT_REJECTED];
+	last_scan_stats["reused"] = counts[SCAN_RESULT_REUSED];
+	last_scan_stats["loaded"] = counts[SCAN_RESULT_LOADED];
+
+	if (!index_path.is_empty()) {
+		Dictionary contents;
+		contents["version"] = INDEX_VERSION;
+		contents["files"] = files;
+
+		auto file = FileAccess::open(index_path, FileAccess::WRITE);
+		ERR_FAIL_COND_V_EDMSG(file.is_null(), modules, "Cannot write module index '" + index_path + "'.");
+		file->store_string(JSON::stringify(contents));
+	}
+
+	tasks.clear();
+	return modules;
+}
+
+Dictionary GDMPTScanner::get_last_scan_stats() const {
+	return last_scan_stats;
+}
+
+void GDMPTScanner::_bind_methods() {
+	ClassDB::bind_method(D_METHOD("scan", "paths", "index_path"),
+			&GDMPTScanner::scan, DEFVAL(""));
+	ClassDB::bind_method(D_METHOD("get_last_scan_stats"),
+			&GDMPTScanner::get_last_scan_stats);
+}
+
+GDMPTScanner::GDMPTScanner() {}
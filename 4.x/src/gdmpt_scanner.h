@@ -0,0 +1,70 @@
+#ifndef GDMPT_SCANNER_H
+#define GDMPT_SCANNER_H
+
+#include "godot_compat.h"
+#include "module_metadata.h"
+
+#include <vector>
+
+namespace godot {
+
+// Reads the metadata of many module files in parallel without creating an
+// `AudioStreamGDMPT` for each. Results can be kept in an index file so that
+// rescans only load files that changed.
+class GDMPTScanner : public RefCounted {
+	GDCLASS(GDMPTScanner, RefCounted)
+
+	enum ScanResult {
+		SCAN_RESULT_FAILED,
+		// Not a module according to the header probe
+		SCAN_RESULT_REJECTED,
+		// Found in the index by size and modification time, or by hash
+		SCAN_RESULT_REUSED,
+		SCAN_RESULT_LOADED
+	};
+
+	struct Entry {
+		uint64_t size = 0;
+		uint64_t modified_time = 0;
+		uint64_t hash = 0;
+		bool is_module = false;
+		ModuleMetadata metadata;
+	};
+
+	struct Task {
+		String path;
+		bool has_previous = false;
+		Entry previous;
+		Entry entry;
+		ScanResult result = SCAN_RESULT_FAILED;
+	};
+
+	std::vector<Task> tasks;
+	Dictionary last_scan_stats;
+
+	// Scans `tasks[index]`. Called from `WorkerThreadPool` threads.
+	void scan_file(uint32_t index);
+
+	static Dictionary entry_to_dictionary(const Entry &entry);
+	static Entry entry_from_dictionary(const Dictionary &dict);
+	static Dictionary metadata_to_dictionary(const String &path, const ModuleMetadata &metadata);
+
+protected:
+	static void _bind_methods();
+
+public:
+	// Returns a `Dictionary` of metadata for every module in `paths`. If
+	// `index_path` is given, unchanged files are taken from the index and the
+	// index is rewritten with the results of this scan.
+	Array scan(const PackedStringArray &paths, const String &index_path = "");
+
+	// Counts of files that were rejected, reused from the index, loaded or
+	// failed during the last scan
+	Dictionary get_last_scan_stats() const;
+
+	GDMPTScanner();
+};
+
+} // namespace godot
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef GODOT_COMPAT_H
+#define GODOT_COMPAT_H
+
+// The sources in this folder are compiled either as a GDExtension against
+// godot-cpp or directly into the engine as a module. `GDMPT_MODULE` is defined
+// by `modules/gdmpt/SCsub` for the latter.
+
+#ifdef GDMPT_MODULE
+
+#include "core/error/error_macros.h"
+#include "core/io/file_access.h"
+#include "core/io/json.h"
+#include "core/object/callable_method_pointer.h"
+#include "core/object/class_db.h"
+#include "core/object/worker_thread_pool.h"
+#include "scene/main/scene_tree.h"
+#include "servers/audio/audio_stream.h"
+#include "servers/audio_server.h"
+
+// Engine classes live in the global namespace. Declared so that
+// `using namespace godot` and the `namespace godot` blocks stay valid.
+namespace godot {
+// Scene tree of the running game, or `nullptr` under a custom `MainLoop`
+inline SceneTree *get_scene_tree() {
+	return SceneTree::get_singleton();
+}
+} // namespace godot
+
+// Engine virtuals have different names than their GDExtension counterparts so
+// the `_`-prefixed methods are only forwarded to, not overridden
+#define GDMPT_OVERRIDE
+
+#else
+
+#include <godot_cpp/classes/audio_server.hpp>
+#include <godot_cpp/classes/audio_stream.hpp>
+#include <godot_cpp/classes/audio_stream_playback_resampled.hpp>
+#include <godot_cpp/classes/engine.hpp>
+#include <godot_cpp/classes/file_access.hpp>
+#include <godot_cpp/classes/json.hpp>
+#include <godot_cpp/classes/scene_tree.hpp>
+#include <godot_cpp/classes/worker_thread_pool.hpp>
+#include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/error_macros.hpp>
+#include <godot_cpp/variant/callable_method_pointer.hpp>
+
+#define GDMPT_OVERRIDE override
+
+namespace godot {
+// Scene tree of the running game, or `nullptr` under a custom `MainLoop`
+inline SceneTree *get_scene_tree() {
+	return Object::cast_to<SceneTree>(Engine::get_singleton()->get_main_loop());
+}
+} // namespace godot
+
+#endif
+
+#endif
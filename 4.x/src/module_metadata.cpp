@@ -0,0 +1,108 @@
+#include "module_metadata.h"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+
+#ifdef GDMPT_FORMATS
+// Two steps so `GDMPT_FORMATS` is expanded, variadic because it has commas
+#define GDMPT_STRINGIFY_ARGS(...) #__VA_ARGS__
+#define GDMPT_STRINGIFY(...) GDMPT_STRINGIFY_ARGS(__VA_ARGS__)
+#endif
+
+namespace {
+
+struct OpenMPTModuleDeleter {
+	void operator()(openmpt_module *p) { openmpt_module_destroy(p); }
+};
+
+} // namespace
+
+bool is_format_enabled(const std::string &format) {
+#ifdef GDMPT_FORMATS
+	std::string name = format;
+	std::transform(name.begin(), name.end(), name.begin(),
+			[](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+	const std::string formats = GDMPT_STRINGIFY(GDMPT_FORMATS);
+	size_t start = 0;
+	while (start <= formats.size()) {
+		auto end = std::min(formats.find(',', start), formats.size());
+		if (formats.compare(start, end - start, name) == 0) {
+			return true;
+		}
+		start = end + 1;
+	}
+	return false;
+#else
+	return true;
+#endif
+}
+
+std::string get_module_metadata(openmpt_module *module, const char *key) {
+	auto value = openmpt_module_get_metadata(module, key);
+	if (value == nullptr) {
+		return std::string();
+	}
+	std::string result(value);
+	openmpt_free_string(value);
+	return result;
+}
+
+size_t get_probe_header_size() {
+	return openmpt_probe_file_header_get_recommended_size();
+}
+
+bool probe_module_header(const void *header, size_t size, uint64_t file_size) {
+	auto result = openmpt_probe_file_header(
+			OPENMPT_PROBE_FILE_HEADER_FLAGS_DEFAULT,
+			header,
+			size,
+			file_size,
+			openmpt_log_func_silent,
+			nullptr,
+			openmpt_error_func_ignore,
+			nullptr,
+			nullptr,
+			nullptr);
+	// `OPENMPT_PROBE_FILE_HEADER_RESULT_WANTMOREDATA` needs a full load to tell
+	return result != OPENMPT_PROBE_FILE_HEADER_RESULT_FAILURE &&
+			result != OPENMPT_PROBE_FILE_HEADER_RESULT_ERROR;
+}
+
+bool read_module_metadata(const void *data, size_t size, ModuleMetadata &metadata) {
+	// Sample data and plugins do not affect any of the metadata
+	const openmpt_module_initial_ctl ctls[] = {
+		{ "load.skip_samples", "1" },
+		{ "load.skip_plugins", "1" },
+		{ nullptr, nullptr },
+	};
+
+	auto module = std::unique_ptr<openmpt_module, OpenMPTModuleDeleter>(
+			openmpt_module_create_from_memory2(
+					data,
+					size,
+					openmpt_log_func_silent,
+					nullptr,
+					openmpt_error_func_ignore,
+					nullptr,
+					nullptr,
+					nullptr,
+					ctls));
+	if (module == nullptr) {
+		return false;
+	}
+
+	metadata.format = get_module_metadata(module.get(), "type");
+	if (!is_format_enabled(metadata.format)) {
+		return false;
+	}
+
+	metadata.title = get_module_metadata(module.get(), "title");
+	metadata.artist = get_module_metadata(module.get(), "artist");
+	metadata.format_name = get_module_metadata(module.get(), "type_long");
+	metadata.duration_seconds = openmpt_module_get_duration_seconds(module.get());
+	metadata.num_channels = openmpt_module_get_num_channels(module.get());
+	metadata.num_subsongs = openmpt_module_get_num_subsongs(module.get());
+	return true;
+}
@@ -0,0 +1,41 @@
+#ifndef MODULE_METADATA_H
+#define MODULE_METADATA_H
+
+#include <libopenmpt/libopenmpt.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Metadata read from a module without preparing it for playback
+struct ModuleMetadata {
+	std::string title;
+	std::string artist;
+	// Short format name, usually the file extension
+	std::string format;
+	std::string format_name;
+	double duration_seconds = 0.0;
+	int32_t num_channels = 0;
+	int32_t num_subsongs = 0;
+};
+
+// Whether modules of `format`, the short format name, can be loaded. Builds
+// that define `GDMPT_FORMATS` as a comma-separated list of format names only
+// accept those.
+bool is_format_enabled(const std::string &format);
+
+// Returns the metadata `key` of `module` or an empty string
+std::string get_module_metadata(openmpt_module *module, const char *key);
+
+// Number of bytes from the start of a file needed by `probe_module_header`
+size_t get_probe_header_size();
+
+// Cheaply checks whether `header`, the start of a file of `file_size` bytes,
+// can be a module. Returns `true` when unsure.
+bool probe_module_header(const void *header, size_t size, uint64_t file_size);
+
+// Loads the module in `data` skipping samples and plugins. Returns `false` if
+// `data` is not a supported module or its format is not enabled.
+bool read_module_metadata(const void *data, size_t size, ModuleMetadata &metadata);
+
+#endif
@@ -1,58 +1,150 @@
 #include "openmpt_module.h"
 
-void OpenMPTModule::set_pointers(ModuleExtUniquePtr p_module, InteractiveUniquePtr p_interactive) {
-	const std::lock_guard<std::mutex> lock(mutex);
+#include "tracer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef GDMPT_LOCK_STATS
+#include <chrono>
+
+namespace {
+thread_local uint64_t thread_wait_nsec = 0;
+}
+
+void ModuleMutex::lock() {
+	// Also counted while disabled, where only the owner is safe
+	RealtimeChecks::note_lock_acquisition(enabled ? nullptr : this);
+	if (!enabled) {
+		return;
+	}
+	if (!mutex.try_lock()) {
+		GDMPT_TRACE_SCOPE("module_lock_wait");
+		auto start = std::chrono::steady_clock::now();
+		mutex.lock();
+		auto end = std::chrono::steady_clock::now();
+
+		uint64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+		thread_wait_nsec += wait;
+		contentions.fetch_add(1, std::memory_order_relaxed);
+		wait_nsec.fetch_add(wait, std::memory_order_relaxed);
+
+		auto max_wait = max_wait_nsec.load(std::memory_order_relaxed);
+		while (wait > max_wait && !max_wait_nsec.compare_exchange_weak(max_wait, wait, std::memory_order_relaxed)) {
+		}
+	}
+	acquisitions.fetch_add(1, std::memory_order_relaxed);
+}
+
+ModuleLockStats ModuleMutex::get_stats() const {
+	ModuleLockStats stats;
+	stats.acquisitions = acquisitions.load(std::memory_order_relaxed);
+	stats.contentions = contentions.load(std::memory_order_relaxed);
+	stats.wait_nsec = wait_nsec.load(std::memory_order_relaxed);
+	stats.max_wait_nsec = max_wait_nsec.load(std::memory_order_relaxed);
+	return stats;
+}
+
+uint64_t ModuleMutex::get_thread_wait_nsec() {
+	return thread_wait_nsec;
+}
+#else
+void ModuleMutex::lock_contended() {
+	GDMPT_TRACE_SCOPE("module_lock_wait");
+	mutex.lock();
+}
+
+ModuleLockStats ModuleMutex::get_stats() const {
+	return ModuleLockStats();
+}
+
+uint64_t ModuleMutex::get_thread_wait_nsec() {
+	return 0;
+}
+#endif
+
+void OpenMPTModule::set_pointers(ModuleExtUniquePtr p_module, InteractiveUniquePtr p_interactive,
+		Interactive2UniquePtr p_interactive2, Interactive3UniquePtr p_interactive3) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	module.swap(p_module);
 	interactive.swap(p_interactive);
+	interactive2.swap(p_interactive2);
+	interactive3.swap(p_interactive3);
 }
 
 bool OpenMPTModule::is_null() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	return module == nullptr;
 }
 
+void OpenMPTModule::set_locking_enabled(bool enable) {
+	mutex.set_enabled(enable);
+}
+
+void OpenMPTModule::set_owned_by_thread(bool owned) {
+	RealtimeChecks::set_owned_lock(owned ? &mutex : nullptr);
+}
+
+void OpenMPTModule::swap(OpenMPTModule &other) {
+	module.swap(other.module);
+	interactive.swap(other.interactive);
+	interactive2.swap(other.interactive2);
+	interactive3.swap(other.interactive3);
+}
+
+void OpenMPTModule::set_error_func(openmpt_error_func error_func, void *user) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	openmpt_module_set_error_func(module_ptr, error_func, user);
+}
+
+ModuleLockStats OpenMPTModule::get_lock_stats() const {
+	return mutex.get_stats();
+}
+
 int OpenMPTModule::set_repeat_count(int32_t repeat_count) {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_set_repeat_count(module_ptr, repeat_count);
 }
 
 int32_t OpenMPTModule::get_repeat_count() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_get_repeat_count(module_ptr);
 }
 
 int OpenMPTModule::set_tempo_factor(double factor) {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	return interactive->set_tempo_factor(module.get(), factor);
 }
 
 double OpenMPTModule::get_tempo_factor() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	return interactive->get_tempo_factor(module.get());
 }
 
 int OpenMPTModule::set_pitch_factor(double factor) {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	return interactive->set_pitch_factor(module.get(), factor);
 }
 
 double OpenMPTModule::get_pitch_factor() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	return interactive->get_pitch_factor(module.get());
 }
 
 int OpenMPTModule::set_interpolation_filter(int32_t filter) {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_set_render_param(
@@ -62,7 +154,7 @@ int OpenMPTModule::set_interpolation_filter(int32_t filter) {
 }
 
 int OpenMPTModule::get_interpolation_filter(int32_t *value) const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_get_render_param(
@@ -71,55 +163,271 @@ int OpenMPTModule::get_interpolation_filter(int32_t *value) const {
 			value);
 }
 
+int OpenMPTModule::set_volume_ramping(int32_t strength) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_set_render_param(
+			module_ptr,
+			OPENMPT_MODULE_RENDER_VOLUMERAMPING_STRENGTH,
+			strength);
+}
+
 int32_t OpenMPTModule::get_num_channels() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_get_num_channels(module_ptr);
 }
 
 int OpenMPTModule::set_channel_volume(int32_t channel, double volume) {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	return interactive->set_channel_volume(module.get(), channel, volume);
 }
 
 double OpenMPTModule::get_channel_volume(int32_t channel) const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	return interactive->get_channel_volume(module.get(), channel);
 }
 
+void OpenMPTModule::set_channels_mute_status(const std::vector<bool> &mute) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	for (size_t i = 0; i < mute.size(); i++) {
+		interactive->set_channel_mute_status(module.get(), static_cast<int32_t>(i), mute[i] ? 1 : 0);
+	}
+}
+
+int32_t OpenMPTModule::get_num_instruments() const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_get_num_instruments(module_ptr);
+}
+
+int32_t OpenMPTModule::get_num_samples() const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_get_num_samples(module_ptr);
+}
+
+std::string OpenMPTModule::get_instrument_name(int32_t instrument) const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	auto name = openmpt_module_get_instrument_name(module_ptr, instrument);
+	if (name == nullptr) {
+		return std::string();
+	}
+	std::string result(name);
+	openmpt_free_string(name);
+	return result;
+}
+
+std::string OpenMPTModule::get_sample_name(int32_t sample) const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	auto name = openmpt_module_get_sample_name(module_ptr, sample);
+	if (name == nullptr) {
+		return std::string();
+	}
+	std::string result(name);
+	openmpt_free_string(name);
+	return result;
+}
+
+int32_t OpenMPTModule::play_note(int32_t instrument, int32_t note, double volume, double panning) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	return interactive->play_note(module.get(), instrument, note, volume, panning);
+}
+
+int OpenMPTModule::stop_note(int32_t channel) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	return interactive->stop_note(module.get(), channel);
+}
+
+int OpenMPTModule::set_note_finetune(int32_t channel, double finetune) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	if (interactive2 == nullptr) {
+		return 0;
+	}
+	return interactive2->set_note_finetune(module.get(), channel, finetune);
+}
+
+double OpenMPTModule::get_note_finetune(int32_t channel) const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	if (interactive2 == nullptr) {
+		return 0.0;
+	}
+	return interactive2->get_note_finetune(module.get(), channel);
+}
+
+int OpenMPTModule::select_subsong(int32_t subsong) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_select_subsong(module_ptr, subsong);
+}
+
+int32_t OpenMPTModule::get_selected_subsong() const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_get_selected_subsong(module_ptr);
+}
+
+std::vector<SubsongMetadata> OpenMPTModule::read_subsong_metadata(int32_t subsong) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	std::vector<SubsongMetadata> subsongs(std::max(openmpt_module_get_num_subsongs(module_ptr), 1));
+	for (int32_t i = 0; i < static_cast<int32_t>(subsongs.size()); i++) {
+		auto &metadata = subsongs[i];
+		openmpt_module_select_subsong(module_ptr, i);
+
+		auto name = openmpt_module_get_subsong_name(module_ptr, i);
+		if (name != nullptr) {
+			metadata.name = name;
+			openmpt_free_string(name);
+		}
+		metadata.duration_seconds = openmpt_module_get_duration_seconds(module_ptr);
+		metadata.start_order = openmpt_module_get_current_order(module_ptr);
+		metadata.start_row = openmpt_module_get_current_row(module_ptr);
+		metadata.num_channels = openmpt_module_get_num_channels(module_ptr);
+		metadata.initial_speed = openmpt_module_get_current_speed(module_ptr);
+		metadata.initial_tempo = openmpt_module_get_current_tempo2(module_ptr);
+		metadata.initial_bpm = openmpt_module_get_current_estimated_bpm(module_ptr);
+	}
+	openmpt_module_select_subsong(module_ptr, subsong);
+	return subsongs;
+}
+
+int32_t OpenMPTModule::get_num_orders() const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_get_num_orders(module_ptr);
+}
+
+int32_t OpenMPTModule::get_num_patterns() const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_get_num_patterns(module_ptr);
+}
+
+int32_t OpenMPTModule::get_order_pattern(int32_t order) const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_get_order_pattern(module_ptr, order);
+}
+
+int32_t OpenMPTModule::get_pattern_num_rows(int32_t pattern) const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_get_pattern_num_rows(module_ptr, pattern);
+}
+
+void OpenMPTModule::get_pattern_commands(int32_t pattern, int32_t num_rows, int32_t num_channels, uint8_t *commands) const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	for (int32_t row = 0; row < num_rows; row++) {
+		for (int32_t channel = 0; channel < num_channels; channel++) {
+			for (int command = 0; command < PATTERN_COMMAND_COUNT; command++) {
+				*commands++ = openmpt_module_get_pattern_row_channel_command(
+						module_ptr, pattern, row, channel, command);
+			}
+		}
+	}
+}
+
+ModulePosition OpenMPTModule::get_current_position() const {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	ModulePosition position;
+	position.order = openmpt_module_get_current_order(module_ptr);
+	position.pattern = openmpt_module_get_current_pattern(module_ptr);
+	position.row = openmpt_module_get_current_row(module_ptr);
+	position.speed = openmpt_module_get_current_speed(module_ptr);
+	position.tempo = openmpt_module_get_current_tempo2(module_ptr);
+	position.tempo_factor = interactive->get_tempo_factor(module.get());
+	position.estimated_bpm = openmpt_module_get_current_estimated_bpm(module_ptr);
+	position.seconds = openmpt_module_get_position_seconds(module_ptr);
+	position.playing_channels = openmpt_module_get_current_playing_channels(module_ptr);
+	position.global_volume = interactive->get_global_volume(module.get());
+	return position;
+}
+
 double OpenMPTModule::get_duration_seconds() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_get_duration_seconds(module_ptr);
 }
 
+int OpenMPTModule::set_current_speed(int32_t speed) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	return interactive->set_current_speed(module.get(), speed);
+}
+
+int OpenMPTModule::set_current_tempo(double tempo) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	if (interactive3 == nullptr) {
+		return interactive->set_current_tempo(module.get(), static_cast<int32_t>(std::lround(tempo)));
+	}
+	return interactive3->set_current_tempo2(module.get(), tempo);
+}
+
+int OpenMPTModule::set_global_volume(double volume) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	return interactive->set_global_volume(module.get(), volume);
+}
+
 double OpenMPTModule::get_current_estimated_bpm() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_get_current_estimated_bpm(module_ptr);
 }
 
 double OpenMPTModule::set_position_seconds(double seconds) {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_set_position_seconds(module_ptr, seconds);
 }
 
+double OpenMPTModule::set_position_order_row(int32_t order, int32_t row) {
+	const std::lock_guard<ModuleMutex> lock(mutex);
+
+	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
+	return openmpt_module_set_position_order_row(module_ptr, order, row);
+}
+
 double OpenMPTModule::get_position_seconds() const {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_get_position_seconds(module_ptr);
 }
 
 size_t OpenMPTModule::read_interleaved_float_stereo(int32_t sample_rate, size_t count, float *interleaved_stereo) {
-	const std::lock_guard<std::mutex> lock(mutex);
+	const std::lock_guard<ModuleMutex> lock(mutex);
 
 	auto module_ptr = reinterpret_cast<openmpt_module *>(module.get());
 	return openmpt_module_read_interleaved_float_stereo(module_ptr, sample_rate, count, interleaved_stereo);
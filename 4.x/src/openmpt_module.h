@@ -1,10 +1,16 @@
 #ifndef OPENMPT_MODULE_H
 #define OPENMPT_MODULE_H
 
+#include "realtime_checks.h"
+
 #include <libopenmpt/libopenmpt_ext.h>
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
 struct OpenMPTModuleExtDeleter {
 	void operator()(openmpt_module_ext *p) { openmpt_module_ext_destroy(p); }
@@ -14,17 +20,128 @@ using ModuleExtUniquePtr =
 		std::unique_ptr<openmpt_module_ext, OpenMPTModuleExtDeleter>;
 using InteractiveUniquePtr =
 		std::unique_ptr<openmpt_module_ext_interface_interactive>;
+using Interactive2UniquePtr =
+		std::unique_ptr<openmpt_module_ext_interface_interactive2>;
+using Interactive3UniquePtr =
+		std::unique_ptr<openmpt_module_ext_interface_interactive3>;
+
+// Playback position read under a single lock
+struct ModulePosition {
+	int32_t order = 0;
+	int32_t pattern = 0;
+	int32_t row = 0;
+	int32_t speed = 0;
+	double tempo = 0.0;
+	double tempo_factor = 1.0;
+	// Excludes `tempo_factor`
+	double estimated_bpm = 0.0;
+	double seconds = 0.0;
+	// Including background channels of NNAs and `play_note`
+	int32_t playing_channels = 0;
+	double global_volume = 1.0;
+};
+
+// What a subsong starts with, read once at load
+struct SubsongMetadata {
+	std::string name;
+	double duration_seconds = 0.0;
+	int32_t start_order = 0;
+	int32_t start_row = 0;
+	int32_t num_channels = 0;
+	int32_t initial_speed = 0;
+	double initial_tempo = 0.0;
+	double initial_bpm = 0.0;
+};
+
+// Wait statistics of a `ModuleMutex`
+struct ModuleLockStats {
+	uint64_t acquisitions = 0;
+	// Acquisitions that found the mutex already locked
+	uint64_t contentions = 0;
+	uint64_t wait_nsec = 0;
+	uint64_t max_wait_nsec = 0;
+};
+
+// Mutex guarding a module. Builds that define `GDMPT_LOCK_STATS` also record
+// how often and how long callers had to wait for it.
+class ModuleMutex {
+	std::mutex mutex;
+	bool enabled = true;
+#ifdef GDMPT_LOCK_STATS
+	std::atomic<uint64_t> acquisitions{ 0 };
+	std::atomic<uint64_t> contentions{ 0 };
+	std::atomic<uint64_t> wait_nsec{ 0 };
+	std::atomic<uint64_t> max_wait_nsec{ 0 };
+#else
+	void lock_contended();
+#endif
+
+public:
+	// Disabling makes `lock` and `unlock` do nothing. Only for modules used by
+	// one thread at a time, and must be set before the module is shared.
+	void set_enabled(bool enable) { enabled = enable; }
+
+	// Waits are recorded by `Tracer` if tracing is enabled
+#ifdef GDMPT_LOCK_STATS
+	void lock();
+#else
+	void lock() {
+		// Also counted while disabled, where only the owner is safe
+		RealtimeChecks::note_lock_acquisition(enabled ? nullptr : this);
+		if (!enabled) {
+			return;
+		}
+		if (!mutex.try_lock()) {
+			lock_contended();
+		}
+	}
+#endif
+	void unlock() {
+		if (enabled) {
+			mutex.unlock();
+		}
+	}
+
+	// Always zero unless built with `GDMPT_LOCK_STATS`
+	ModuleLockStats get_stats() const;
+
+	// Total time the calling thread has waited on any `ModuleMutex`. Always
+	// zero unless built with `GDMPT_LOCK_STATS`.
+	static uint64_t get_thread_wait_nsec();
+};
 
 class OpenMPTModule {
 	ModuleExtUniquePtr module;
 	InteractiveUniquePtr interactive;
-	mutable std::mutex mutex; // Needs to be accessed from `const` methods
+	// Optional, only needed for note finetune
+	Interactive2UniquePtr interactive2;
+	// Optional, only needed for fractional tempos
+	Interactive3UniquePtr interactive3;
+	mutable ModuleMutex mutex; // Needs to be accessed from `const` methods
 
 public:
-	void set_pointers(ModuleExtUniquePtr p_module, InteractiveUniquePtr p_interactive);
+	void set_pointers(ModuleExtUniquePtr p_module, InteractiveUniquePtr p_interactive,
+			Interactive2UniquePtr p_interactive2 = nullptr, Interactive3UniquePtr p_interactive3 = nullptr);
 
 	bool is_null() const;
 
+	// Modules that only ever one thread uses at a time can skip the mutex, see
+	// `ModuleMutex::set_enabled`
+	void set_locking_enabled(bool enable);
+
+	// Tells `RealtimeChecks` that the calling thread is the one using the
+	// module while locking is disabled, until called with `false`
+	void set_owned_by_thread(bool owned);
+
+	// Exchanges the libopenmpt instances of both modules without allocating.
+	// Not locked: neither module may be in use by another thread.
+	void swap(OpenMPTModule &other);
+
+	// Replaces the error func given when the module was created
+	void set_error_func(openmpt_error_func error_func, void *user);
+
+	ModuleLockStats get_lock_stats() const;
+
 	int set_repeat_count(int32_t repeat_count);
 	int32_t get_repeat_count() const;
 
@@ -37,16 +154,68 @@ public:
 	int set_interpolation_filter(int32_t filter);
 	int get_interpolation_filter(int32_t *value) const;
 
+	int set_volume_ramping(int32_t strength);
+
 	int32_t get_num_channels() const;
 
 	int set_channel_volume(int32_t channel, double volume);
 	double get_channel_volume(int32_t channel) const;
 
+	// Sets the mute status of every channel at once so that rendering never
+	// sees a partial update. Muted channels are skipped by the mixer instead
+	// of mixed at volume 0.
+	void set_channels_mute_status(const std::vector<bool> &mute);
+
+	// Modules without instruments play samples directly, see `play_note`
+	int32_t get_num_instruments() const;
+	int32_t get_num_samples() const;
+	std::string get_instrument_name(int32_t instrument) const;
+	std::string get_sample_name(int32_t sample) const;
+
+	// Plays `note` of `instrument` (or sample if the module has no
+	// instruments) on a free background channel. Returns the channel or -1.
+	int32_t play_note(int32_t instrument, int32_t note, double volume, double panning);
+	int stop_note(int32_t channel);
+	// Fraction of a semitone. Does nothing without the interactive2 interface.
+	int set_note_finetune(int32_t channel, double finetune);
+	// Returns 0 without the interactive2 interface
+	double get_note_finetune(int32_t channel) const;
+
+	// Selecting a subsong moves the position to its start
+	int select_subsong(int32_t subsong);
+	int32_t get_selected_subsong() const;
+
+	// Selects every subsong in turn to read its metadata and selects
+	// `subsong` afterwards
+	std::vector<SubsongMetadata> read_subsong_metadata(int32_t subsong);
+
+	int32_t get_num_orders() const;
+	int32_t get_num_patterns() const;
+	int32_t get_order_pattern(int32_t order) const;
+	int32_t get_pattern_num_rows(int32_t pattern) const;
+
+	// Writes every command of every cell of `pattern` to `commands`, which must
+	// hold `num_rows * num_channels * PATTERN_COMMAND_COUNT` bytes. Cells are
+	// stored row by row and the commands of a cell follow the
+	// `OPENMPT_MODULE_COMMAND_*` order.
+	static constexpr int32_t PATTERN_COMMAND_COUNT = 6;
+	void get_pattern_commands(int32_t pattern, int32_t num_rows, int32_t num_channels, uint8_t *commands) const;
+
+	ModulePosition get_current_position() const;
+
 	double get_duration_seconds() const;
 
 	double get_current_estimated_bpm() const;
 
+	// Overwrite the song state until the pattern changes it again, without
+	// seeking
+	int set_current_speed(int32_t speed);
+	// Rounded to whole BPM without the interactive3 interface
+	int set_current_tempo(double tempo);
+	int set_global_volume(double volume);
+
 	double set_position_seconds(double seconds);
+	double set_position_order_row(int32_t order, int32_t row);
 	double get_position_seconds() const;
 
 	size_t read_interleaved_float_stereo(int32_t sample_rate, size_t count, float *interleaved_stereo);
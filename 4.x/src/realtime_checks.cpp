@@ -0,0 +1,112 @@
+#include "realtime_checks.h"
+
+#ifdef GDMPT_REALTIME_CHECKS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+// Plain thread-locals so that `operator new` can use them at any time
+thread_local int32_t scope_depth = 0;
+thread_local int32_t allocation_scope_depth = 0;
+thread_local uint64_t scope_allocations = 0;
+thread_local uint64_t scope_lock_acquisitions = 0;
+thread_local const void *owned_lock = nullptr;
+
+std::atomic<uint64_t> total_scopes{ 0 };
+std::atomic<uint64_t> total_allocations{ 0 };
+std::atomic<uint64_t> total_lock_acquisitions{ 0 };
+std::atomic<uint64_t> unreported_allocations{ 0 };
+std::atomic<uint64_t> unreported_lock_acquisitions{ 0 };
+} // namespace
+
+void RealtimeChecks::note_allocation() {
+	if (scope_depth > 0 && allocation_scope_depth == 0) {
+		scope_allocations++;
+	}
+}
+
+void RealtimeChecks::note_lock_acquisition(const void *disabled_lock) {
+	if (scope_depth > 0 && (disabled_lock == nullptr || disabled_lock != owned_lock)) {
+		scope_lock_acquisitions++;
+	}
+}
+
+void RealtimeChecks::set_owned_lock(const void *lock) {
+	owned_lock = lock;
+}
+
+RealtimeViolations RealtimeChecks::get_totals(uint64_t &scopes) {
+	scopes = total_scopes.load(std::memory_order_relaxed);
+
+	RealtimeViolations violations;
+	violations.allocations = total_allocations.load(std::memory_order_relaxed);
+	violations.lock_acquisitions = total_lock_acquisitions.load(std::memory_order_relaxed);
+	return violations;
+}
+
+RealtimeViolations RealtimeChecks::take_unreported() {
+	RealtimeViolations violations;
+	violations.allocations = unreported_allocations.exchange(0, std::memory_order_relaxed);
+	violations.lock_acquisitions = unreported_lock_acquisitions.exchange(0, std::memory_order_relaxed);
+	return violations;
+}
+
+RealtimeScope::RealtimeScope() {
+	if (scope_depth++ == 0) {
+		scope_allocations = 0;
+		scope_lock_acquisitions = 0;
+	}
+}
+
+RealtimeScope::~RealtimeScope() {
+	if (--scope_depth > 0 || (scope_allocations == 0 && scope_lock_acquisitions == 0)) {
+		return;
+	}
+	total_scopes.fetch_add(1, std::memory_order_relaxed);
+	total_allocations.fetch_add(scope_allocations, std::memory_order_relaxed);
+	total_lock_acquisitions.fetch_add(scope_lock_acquisitions, std::memory_order_relaxed);
+	unreported_allocations.fetch_add(scope_allocations, std::memory_order_relaxed);
+	unreported_lock_acquisitions.fetch_add(scope_lock_acquisitions, std::memory_order_relaxed);
+}
+
+RealtimeAllocationScope::RealtimeAllocationScope() {
+	allocation_scope_depth++;
+}
+
+RealtimeAllocationScope::~RealtimeAllocationScope() {
+	allocation_scope_depth--;
+}
+
+// The array, nothrow and sized forms end up here or in `free` with the
+// standard library's defaults. Aligned allocations are not counted.
+void *operator new(std::size_t size) {
+	RealtimeChecks::note_allocation();
+	void *ptr = std::malloc(size == 0 ? 1 : size);
+	if (ptr == nullptr) {
+#ifdef __cpp_exceptions
+		throw std::bad_alloc();
+#else
+		std::abort();
+#endif
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+	std::free(ptr);
+}
+#else
+RealtimeViolations RealtimeChecks::get_totals(uint64_t &scopes) {
+	scopes = 0;
+	return RealtimeViolations();
+}
+
+RealtimeViolations RealtimeChecks::take_unreported() {
+	return RealtimeViolations();
+}
+#endif
@@ -0,0 +1,78 @@
+#ifndef REALTIME_CHECKS_H
+#define REALTIME_CHECKS_H
+
+#include <cstdint>
+
+// What a thread did inside a `RealtimeScope` that the audio thread must not do
+struct RealtimeViolations {
+	uint64_t allocations = 0;
+	uint64_t lock_acquisitions = 0;
+
+	bool any() const { return allocations > 0 || lock_acquisitions > 0; }
+};
+
+// Debug hook counting heap allocations and `ModuleMutex` acquisitions of the
+// threads that render audio. Only builds that define `GDMPT_REALTIME_CHECKS`
+// count anything; they replace the global `operator new` to see allocations.
+// Everything is a no-op otherwise. Locks and allocations inside Godot, e.g. of
+// `WorkerThreadPool` or `Memory::alloc_static`, are not seen.
+class RealtimeChecks {
+public:
+	static constexpr bool is_enabled() {
+#ifdef GDMPT_REALTIME_CHECKS
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// `disabled_lock` is the mutex if locking it does nothing, which is not
+	// counted for the thread that owns it, see `set_owned_lock`
+#ifdef GDMPT_REALTIME_CHECKS
+	static void note_allocation();
+	static void note_lock_acquisition(const void *disabled_lock = nullptr);
+	// Marks `lock` as only used by the calling thread until it is called
+	// again, e.g. with nullptr
+	static void set_owned_lock(const void *lock);
+#else
+	static void note_allocation() {}
+	static void note_lock_acquisition(const void * = nullptr) {}
+	static void set_owned_lock(const void *) {}
+#endif
+
+	// Sums over every scope that had violations, and the number of such scopes
+	static RealtimeViolations get_totals(uint64_t &scopes);
+
+	// Violations since the last call, to report each of them once
+	static RealtimeViolations take_unreported();
+};
+
+// Counts the violations of the calling thread while it exists. Nested scopes
+// belong to the outermost one, which adds its counts to the totals when it
+// ends.
+class RealtimeScope {
+public:
+#ifdef GDMPT_REALTIME_CHECKS
+	RealtimeScope();
+	~RealtimeScope();
+#else
+	// Not trivial, which keeps unused variable warnings away
+	~RealtimeScope() {}
+#endif
+};
+
+// Allows allocations inside a `RealtimeScope`. Only for libopenmpt's seeks,
+// which allocate and happen on request or at the end of the song rather than
+// on every callback. Lock acquisitions are still counted.
+class RealtimeAllocationScope {
+public:
+#ifdef GDMPT_REALTIME_CHECKS
+	RealtimeAllocationScope();
+	~RealtimeAllocationScope();
+#else
+	// Not trivial, which keeps unused variable warnings away
+	~RealtimeAllocationScope() {}
+#endif
+};
+
+#endif
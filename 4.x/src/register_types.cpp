@@ -7,6 +7,8 @@
 #include <godot_cpp/godot.hpp>
 
 #include "audio_stream_gdmpt.h"
+#include "audio_stream_gdmpt_layers.h"
+#include "gdmpt_scanner.h"
 
 using namespace godot;
 
@@ -17,6 +19,9 @@ void initialize_module(ModuleInitializationLevel p_level) {
 
 	ClassDB::register_class<AudioStreamGDMPT>();
 	ClassDB::register_class<AudioStreamGDMPTPlayback>();
+	ClassDB::register_class<AudioStreamGDMPTLayers>();
+	ClassDB::register_class<AudioStreamGDMPTLayersPlayback>();
+	ClassDB::register_class<GDMPTScanner>();
 }
 
 void uninitialize_module(ModuleInitializationLevel p_level) {
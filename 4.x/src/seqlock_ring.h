@@ -0,0 +1,76 @@
+#ifndef SEQLOCK_RING_H
+#define SEQLOCK_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Ring of the last `Capacity` values pushed by a single writer thread. Any
+// number of threads can read entries without locking and without blocking the
+// writer. A read fails instead of returning a torn value if the entry is
+// being overwritten.
+template <typename T, size_t Capacity>
+class SeqlockRing {
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+	static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	struct Slot {
+		// `2 * index + 1` while entry `index` is written, `2 * index + 2` after
+		std::atomic<uint64_t> sequence{ 0 };
+		std::array<std::atomic<uint64_t>, WORDS> words{};
+	};
+
+	std::array<Slot, Capacity> slots;
+	std::atomic<uint64_t> count{ 0 };
+
+public:
+	// Writer only
+	void push(const T &value) {
+		uint64_t words[WORDS] = {};
+		std::memcpy(words, &value, sizeof(T));
+
+		auto index = count.load(std::memory_order_relaxed);
+		auto &slot = slots[index % Capacity];
+		slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < WORDS; i++) {
+			slot.words[i].store(words[i], std::memory_order_relaxed);
+		}
+		slot.sequence.store(2 * index + 2, std::memory_order_release);
+		count.store(index + 1, std::memory_order_release);
+	}
+
+	// Number of values pushed so far. Entries `[size() - Capacity, size())`
+	// can be read.
+	uint64_t size() const {
+		return count.load(std::memory_order_acquire);
+	}
+
+	// Reads the `index`-th value ever pushed. Returns `false` if it was not
+	// pushed yet or was overwritten.
+	bool read(uint64_t index, T &value) const {
+		const auto &slot = slots[index % Capacity];
+
+		auto sequence = slot.sequence.load(std::memory_order_acquire);
+		if (sequence != 2 * index + 2) {
+			return false;
+		}
+		uint64_t words[WORDS];
+		for (size_t i = 0; i < WORDS; i++) {
+			words[i] = slot.words[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+			return false;
+		}
+
+		std::memcpy(&value, words, sizeof(T));
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Fixed-capacity queue for exactly one producer thread and one consumer
+// thread. Neither side blocks or allocates, so it can be used from the audio
+// thread.
+template <typename T, size_t Capacity>
+class SPSCQueue {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+	std::array<T, Capacity> items;
+	// Only written by the consumer
+	std::atomic<size_t> head{ 0 };
+	// Only written by the producer
+	std::atomic<size_t> tail{ 0 };
+
+public:
+	// Returns `false` if the queue is full. Producer only.
+	bool push(const T &item) {
+		auto current_tail = tail.load(std::memory_order_relaxed);
+		if (current_tail - head.load(std::memory_order_acquire) == Capacity) {
+			return false;
+		}
+		items[current_tail & (Capacity - 1)] = item;
+		tail.store(current_tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Returns `false` if the queue is empty. Consumer only.
+	bool pop(T &item) {
+		auto current_head = head.load(std::memory_order_relaxed);
+		if (current_head == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = items[current_head & (Capacity - 1)];
+		head.store(current_head + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "tracer.h"
+
+#include "seqlock_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace {
+struct ThreadEvents {
+	SeqlockRing<Tracer::Event, Tracer::EVENTS_PER_THREAD> events;
+};
+
+constexpr size_t UNCLAIMED = SIZE_MAX;
+
+// Allocated by the first `set_enabled(true)` and kept afterwards so that
+// recording threads never see it go away
+std::unique_ptr<ThreadEvents[]> thread_events_storage;
+std::atomic<ThreadEvents *> thread_events{ nullptr };
+// Threads that claimed a ring, can grow past `MAX_THREADS`
+std::atomic<size_t> thread_count{ 0 };
+// Incremented whenever tracing is enabled, claims of earlier epochs are void
+std::atomic<uint32_t> claim_epoch{ 0 };
+std::atomic<uint64_t> enabled_since_nsec{ 0 };
+std::mutex enable_mutex;
+
+thread_local size_t thread_index = UNCLAIMED;
+thread_local uint32_t thread_epoch = 0;
+} // namespace
+
+std::atomic<bool> Tracer::enabled{ false };
+
+void Tracer::set_enabled(bool enable) {
+	const std::lock_guard<std::mutex> lock(enable_mutex);
+
+	if (enable) {
+		if (thread_events_storage == nullptr) {
+			thread_events_storage = std::make_unique<ThreadEvents[]>(MAX_THREADS);
+			thread_events.store(thread_events_storage.get(), std::memory_order_release);
+		}
+		enabled_since_nsec.store(now_nsec(), std::memory_order_relaxed);
+		// A thread still recording under its old claim can mix up an event
+		// with the thread that claims the ring next. Events only hold
+		// pointers to literals, so the trace is never corrupted beyond that.
+		thread_count.store(0, std::memory_order_relaxed);
+		claim_epoch.fetch_add(1, std::memory_order_release);
+	}
+	enabled.store(enable, std::memory_order_release);
+}
+
+uint64_t Tracer::now_nsec() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+}
+
+void Tracer::record_span(const char *name, uint64_t start_nsec, uint64_t end_nsec) {
+	Event event;
+	event.name = name;
+	event.start_nsec = start_nsec;
+	event.duration_nsec = end_nsec - start_nsec;
+	record(event);
+}
+
+void Tracer::record_instant(const char *name) {
+	if (!is_enabled()) {
+		return;
+	}
+	Event event;
+	event.name = name;
+	event.start_nsec = now_nsec();
+	event.instant = true;
+	record(event);
+}
+
+void Tracer::record(const Event &event) {
+	auto buffers = thread_events.load(std::memory_order_acquire);
+	if (buffers == nullptr) {
+		return;
+	}
+	auto epoch = claim_epoch.load(std::memory_order_acquire);
+	if (thread_index == UNCLAIMED || thread_epoch != epoch) {
+		thread_index = thread_count.fetch_add(1, std::memory_order_relaxed);
+		thread_epoch = epoch;
+	}
+	if (thread_index >= MAX_THREADS) {
+		return;
+	}
+	buffers[thread_index].events.push(event);
+}
+
+std::string Tracer::to_chrome_json() {
+	std::string json = "{\"traceEvents\":[";
+
+	auto buffers = thread_events.load(std::memory_order_acquire);
+	auto since = enabled_since_nsec.load(std::memory_order_relaxed);
+	auto threads = buffers == nullptr ? 0 : std::min(thread_count.load(std::memory_order_relaxed), MAX_THREADS);
+
+	bool first = true;
+	for (size_t thread = 0; thread < threads; thread++) {
+		const auto &events = buffers[thread].events;
+		auto size = events.size();
+		auto begin = size > EVENTS_PER_THREAD ? size - EVENTS_PER_THREAD : 0;
+
+		for (auto i = begin; i < size; i++) {
+			// Entries the thread is overwriting right now are skipped
+			Event event;
+			if (!events.read(i, event) || event.start_nsec < since) {
+				continue;
+			}
+
+			// Timestamps are in microseconds
+			char line[256];
+			double ts = (event.start_nsec - since) / 1000.0;
+			if (event.instant) {
+				std::snprintf(line, sizeof(line),
+						"{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%zu}",
+						event.name, ts, thread);
+			} else {
+				std::snprintf(line, sizeof(line),
+						"{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu}",
+						event.name, ts, event.duration_nsec / 1000.0, thread);
+			}
+			json += first ? "\n" : ",\n";
+			json += line;
+			first = false;
+		}
+	}
+
+	char other_data[64];
+	std::snprintf(other_data, sizeof(other_data), "\n],\"otherData\":{\"dropped_threads\":%zu}",
+			get_dropped_thread_count());
+	json += other_data;
+	json += ",\"displayTimeUnit\":\"ms\"}\n";
+	return json;
+}
+
+size_t Tracer::get_dropped_thread_count() {
+	auto threads = thread_count.load(std::memory_order_relaxed);
+	return threads > MAX_THREADS ? threads - MAX_THREADS : 0;
+}
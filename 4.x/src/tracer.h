@@ -0,0 +1,87 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define GDMPT_TRACE_CONCAT_INNER(a, b) a##b
+#define GDMPT_TRACE_CONCAT(a, b) GDMPT_TRACE_CONCAT_INNER(a, b)
+
+// Records a span named `name` until the end of the enclosing scope
+#define GDMPT_TRACE_SCOPE(name) TraceScope GDMPT_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+// Records spans and instant events into preallocated per-thread rings and
+// writes them as a Chrome trace, which Perfetto and `chrome://tracing` open.
+// Recording neither locks nor allocates, and is a single relaxed load while
+// tracing is disabled. Event names must be string literals.
+class Tracer {
+public:
+	struct Event {
+		const char *name = nullptr;
+		uint64_t start_nsec = 0;
+		uint64_t duration_nsec = 0;
+		bool instant = false;
+	};
+
+	// Events kept per thread and threads that can record. Threads claim a ring
+	// again every time tracing is enabled, so threads that exited do not keep
+	// theirs. Events of further threads are dropped and their number is
+	// written to the JSON.
+	static constexpr size_t EVENTS_PER_THREAD = 4096;
+	static constexpr size_t MAX_THREADS = 16;
+
+	static bool is_enabled() {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Allocates the rings on first use. Only events recorded after the last
+	// call that enabled tracing are written.
+	static void set_enabled(bool enable);
+
+	static uint64_t now_nsec();
+
+	static void record_span(const char *name, uint64_t start_nsec, uint64_t end_nsec);
+	static void record_instant(const char *name);
+
+	// Chrome trace event format JSON of the events in the rings
+	static std::string to_chrome_json();
+
+	// Threads that recorded since tracing was enabled but found no free ring
+	static size_t get_dropped_thread_count();
+
+private:
+	static std::atomic<bool> enabled;
+
+	static void record(const Event &event);
+};
+
+// Span from construction to destruction or `end`. Does nothing if tracing was
+// disabled when it started.
+class TraceScope {
+	const char *name;
+	uint64_t start_nsec = 0;
+
+public:
+	explicit TraceScope(const char *p_name) :
+			name(Tracer::is_enabled() ? p_name : nullptr) {
+		if (name != nullptr) {
+			start_nsec = Tracer::now_nsec();
+		}
+	}
+
+	void end() {
+		if (name != nullptr) {
+			Tracer::record_span(name, start_nsec, Tracer::now_nsec());
+			name = nullptr;
+		}
+	}
+
+	~TraceScope() { end(); }
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef GDMPT_TOOLS_LOAD_MODULE_H
+#define GDMPT_TOOLS_LOAD_MODULE_H
+
+#include "openmpt_module.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+// Reads the file at `path` into `data`. Prints the reason and returns `false`
+// on failure.
+inline bool read_module_file(const char *path, std::vector<char> &data) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		std::fprintf(stderr, "Cannot open '%s'\n", path);
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+// Creates `module` from `data`, which has to outlive `module`. `path` is only
+// used in messages. Prints the reason and returns `false` on failure.
+inline bool create_module(const char *path, const std::vector<char> &data, OpenMPTModule &module) {
+	int error = OPENMPT_ERROR_OK;
+	auto ptr = openmpt_module_ext_create_from_memory(
+			data.data(),
+			data.size(),
+			openmpt_log_func_silent,
+			nullptr,
+			openmpt_error_func_ignore,
+			nullptr,
+			&error,
+			nullptr,
+			nullptr);
+	if (ptr == nullptr) {
+		std::fprintf(stderr, "Unable to create OpenMPT module from '%s' (error %d)\n", path, error);
+		return false;
+	}
+	auto module_ext = ModuleExtUniquePtr(ptr);
+
+	auto interactive = std::make_unique<openmpt_module_ext_interface_interactive>();
+	error = openmpt_module_ext_get_interface(
+			module_ext.get(),
+			LIBOPENMPT_EXT_C_INTERFACE_INTERACTIVE,
+			interactive.get(),
+			sizeof(openmpt_module_ext_interface_interactive));
+	if (error == 0) {
+		std::fprintf(stderr, "Unable to get interface from module_ext\n");
+		return false;
+	}
+
+	auto interactive2 =
+			std::make_unique<openmpt_module_ext_interface_interactive2>();
+	error = openmpt_module_ext_get_interface(
+			module_ext.get(),
+			LIBOPENMPT_EXT_C_INTERFACE_INTERACTIVE2,
+			interactive2.get(),
+			sizeof(openmpt_module_ext_interface_interactive2));
+	if (error == 0) {
+		interactive2.reset();
+	}
+
+	module.set_pointers(std::move(module_ext), std::move(interactive), std::move(interactive2));
+	return true;
+}
+
+// Reads `path` into `data` and creates `module` from it. `data` has to outlive
+// `module`. Prints the reason and returns `false` on failure.
+inline bool load_module(const char *path, std::vector<char> &data, OpenMPTModule &module) {
+	return read_module_file(path, data) && create_module(path, data, module);
+}
+
+#endif
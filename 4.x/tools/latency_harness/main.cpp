@@ -0,0 +1,357 @@
+// Drives `OpenMPTModule::read_interleaved_float_stereo` at the cadence of an
+// audio callback while control threads call the setters and getters the way a
+// game would. Reports the render time distribution, deadline misses and how
+// long the render thread waited on the module lock. With `--realtime`, the
+// render thread owns the module alone, like the extension's audio thread, and
+// makes the module calls of the extension's mix itself. Its heap allocations
+// and module locks are counted instead. `AudioStreamGDMPT`'s own code needs
+// Godot and is not run.
+
+#include "load_module.h"
+#include "realtime_checks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+	const char *path = nullptr;
+	int32_t rate = 48000;
+	int32_t block = 512;
+	double seconds = 10.0;
+	double setter_hz = 1000.0;
+	double getter_hz = 1000.0;
+	double seek_hz = 10.0;
+	int32_t setter_threads = 1;
+	int32_t getter_threads = 1;
+	bool realtime = false;
+};
+
+// Render thread measurements, one entry per callback
+struct CallbackStats {
+	std::vector<uint64_t> render_nsec;
+	std::vector<uint64_t> lock_wait_nsec;
+	uint64_t deadline_misses = 0;
+};
+
+static void print_usage() {
+	std::fprintf(stderr,
+			"Usage: latency_harness <module> [options]\n"
+			"  --rate=N            Output sampling rate (48000)\n"
+			"  --block=N           Frames per callback (512)\n"
+			"  --seconds=N         Duration of the run (10)\n"
+			"  --setter-hz=N       Volume/tempo setter calls per second and thread (1000)\n"
+			"  --getter-hz=N       Getter calls per second and thread (1000)\n"
+			"  --seek-hz=N         Seeks per second, 0 to disable (10)\n"
+			"  --setter-threads=N  Number of setter threads (1)\n"
+			"  --getter-threads=N  Number of getter threads (1)\n"
+			"  --realtime          Only the render thread uses the module, without locking,\n"
+			"                      and also applies changes and reads the position.\n"
+			"                      Fails if it allocates or locks. Needs realtime_checks=yes.\n");
+}
+
+static bool parse_options(int argc, char **argv, Options &options) {
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (std::strncmp(arg, "--", 2) != 0) {
+			if (options.path != nullptr) {
+				return false;
+			}
+			options.path = arg;
+			continue;
+		}
+
+		if (std::strcmp(arg, "--realtime") == 0) {
+			options.realtime = true;
+			continue;
+		}
+
+		const char *value = std::strchr(arg, '=');
+		if (value == nullptr) {
+			return false;
+		}
+		std::string name(arg + 2, value - arg - 2);
+		value++;
+
+		if (name == "rate") {
+			options.rate = std::atoi(value);
+		} else if (name == "block") {
+			options.block = std::atoi(value);
+		} else if (name == "seconds") {
+			options.seconds = std::atof(value);
+		} else if (name == "setter-hz") {
+			options.setter_hz = std::atof(value);
+		} else if (name == "getter-hz") {
+			options.getter_hz = std::atof(value);
+		} else if (name == "seek-hz") {
+			options.seek_hz = std::atof(value);
+		} else if (name == "setter-threads") {
+			options.setter_threads = std::atoi(value);
+		} else if (name == "getter-threads") {
+			options.getter_threads = std::atoi(value);
+		} else {
+			return false;
+		}
+	}
+	return options.path != nullptr && options.rate > 0 && options.block > 0 && options.seconds > 0.0;
+}
+
+// Renders one block per callback period, the way an audio device pulls them
+static void render_thread(OpenMPTModule &module, const Options &options, CallbackStats &stats) {
+	std::vector<float> buffer(static_cast<size_t>(options.block) * 2);
+	auto period = std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(static_cast<double>(options.block) / options.rate));
+	auto callbacks = static_cast<size_t>(options.seconds / std::chrono::duration<double>(period).count());
+
+	// Reserved up front to not allocate while measuring
+	stats.render_nsec.reserve(callbacks);
+	stats.lock_wait_nsec.reserve(callbacks);
+
+	auto num_channels = std::max(module.get_num_channels(), 1);
+	std::vector<bool> mute_status(num_channels, false);
+	if (options.realtime) {
+		module.set_owned_by_thread(true);
+	}
+
+	auto scheduled = Clock::now();
+	for (size_t i = 0; i < callbacks; i++) {
+		auto wait_before = ModuleMutex::get_thread_wait_nsec();
+		auto start = Clock::now();
+		{
+			RealtimeScope realtime_scope;
+			if (options.realtime) {
+				// The changes that the extension's mix applies for the main
+				// thread, one of each per callback
+				auto channel = static_cast<int32_t>(i % num_channels);
+				module.set_channel_volume(channel, i % 2 == 0 ? 0.5 : 1.0);
+				mute_status[channel] = !mute_status[channel];
+				module.set_channels_mute_status(mute_status);
+				module.set_tempo_factor(i % 2 == 0 ? 1.0 : 1.01);
+			}
+			module.read_interleaved_float_stereo(options.rate, options.block, buffer.data());
+			if (options.realtime) {
+				// Published after every mix
+				module.get_current_position();
+			}
+		}
+		auto end = Clock::now();
+
+		stats.render_nsec.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+		stats.lock_wait_nsec.push_back(ModuleMutex::get_thread_wait_nsec() - wait_before);
+
+		scheduled += period;
+		if (end > scheduled) {
+			// The device would have underrun. Start over from now instead of
+			// trying to catch up.
+			stats.deadline_misses++;
+			scheduled = end;
+		} else {
+			std::this_thread::sleep_until(scheduled);
+		}
+	}
+
+	if (options.realtime) {
+		module.set_owned_by_thread(false);
+	}
+}
+
+// Calls `call` `hz` times per second until `running` is cleared. Returns the
+// number of calls.
+template <typename F>
+static uint64_t control_thread(double hz, const std::atomic<bool> &running, F call) {
+	if (hz <= 0.0) {
+		return 0;
+	}
+	auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / hz));
+
+	uint64_t calls = 0;
+	auto scheduled = Clock::now();
+	while (running.load(std::memory_order_relaxed)) {
+		call();
+		calls++;
+
+		scheduled += period;
+		auto now = Clock::now();
+		if (now < scheduled) {
+			std::this_thread::sleep_until(scheduled);
+		} else {
+			scheduled = now;
+		}
+	}
+	return calls;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	auto index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static double to_usec(uint64_t nsec) {
+	return nsec / 1000.0;
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!parse_options(argc, argv, options)) {
+		print_usage();
+		return 2;
+	}
+	if (options.realtime && !RealtimeChecks::is_enabled()) {
+		std::fprintf(stderr, "--realtime needs a build with realtime_checks=yes.\n");
+		return 2;
+	}
+
+	std::vector<char> data;
+	OpenMPTModule module;
+	if (!load_module(options.path, data, module)) {
+		return 2;
+	}
+	// Keep rendering for the whole run
+	module.set_repeat_count(-1);
+	if (options.realtime) {
+		// The extension's setup, where the audio thread applies all changes
+		// itself. Other threads would race with it.
+		module.set_locking_enabled(false);
+		options.setter_threads = 0;
+		options.getter_threads = 0;
+		options.seek_hz = 0.0;
+	}
+
+	auto num_channels = std::max(module.get_num_channels(), 1);
+	auto duration = std::max(module.get_duration_seconds(), 1.0);
+
+	std::atomic<bool> running{ true };
+	CallbackStats stats;
+	std::vector<uint64_t> setter_calls(options.setter_threads);
+	std::vector<uint64_t> getter_calls(options.getter_threads);
+	uint64_t seek_calls = 0;
+
+	std::vector<std::thread> threads;
+	for (int32_t i = 0; i < options.setter_threads; i++) {
+		threads.emplace_back([&, i]() {
+			std::mt19937 rng(i);
+			std::uniform_int_distribution<int32_t> channel(0, num_channels - 1);
+			std::uniform_real_distribution<double> volume(0.0, 1.0);
+			std::uniform_real_distribution<double> tempo(0.9, 1.1);
+			uint64_t n = 0;
+			setter_calls[i] = control_thread(options.setter_hz, running, [&]() {
+				if (n++ % 2 == 0) {
+					module.set_channel_volume(channel(rng), volume(rng));
+				} else {
+					module.set_tempo_factor(tempo(rng));
+				}
+			});
+		});
+	}
+	for (int32_t i = 0; i < options.getter_threads; i++) {
+		threads.emplace_back([&, i]() {
+			std::mt19937 rng(1000 + i);
+			std::uniform_int_distribution<int32_t> channel(0, num_channels - 1);
+			uint64_t n = 0;
+			getter_calls[i] = control_thread(options.getter_hz, running, [&]() {
+				switch (n++ % 4) {
+					case 0:
+						module.get_position_seconds();
+						break;
+					case 1:
+						module.get_current_position();
+						break;
+					case 2:
+						module.get_channel_volume(channel(rng));
+						break;
+					default:
+						module.get_tempo_factor();
+						break;
+				}
+			});
+		});
+	}
+	if (options.seek_hz > 0.0) {
+		threads.emplace_back([&]() {
+			std::mt19937 rng(2000);
+			std::uniform_real_distribution<double> position(0.0, duration);
+			seek_calls = control_thread(options.seek_hz, running, [&]() {
+				module.set_position_seconds(position(rng));
+			});
+		});
+	}
+
+	render_thread(module, options, stats);
+
+	running.store(false, std::memory_order_relaxed);
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	auto render_nsec = stats.render_nsec;
+	auto lock_wait_nsec = stats.lock_wait_nsec;
+	std::sort(render_nsec.begin(), render_nsec.end());
+	std::sort(lock_wait_nsec.begin(), lock_wait_nsec.end());
+
+	uint64_t total_lock_wait = 0;
+	for (auto wait : lock_wait_nsec) {
+		total_lock_wait += wait;
+	}
+
+	uint64_t total_setter_calls = 0;
+	for (auto calls : setter_calls) {
+		total_setter_calls += calls;
+	}
+	uint64_t total_getter_calls = 0;
+	for (auto calls : getter_calls) {
+		total_getter_calls += calls;
+	}
+
+	auto callbacks = render_nsec.size();
+	auto deadline_usec = 1000000.0 * options.block / options.rate;
+	auto lock_stats = module.get_lock_stats();
+
+	std::printf("callbacks:        %zu x %d frames @ %d Hz, deadline %.1f us\n",
+			callbacks, options.block, options.rate, deadline_usec);
+	std::printf("render time:      p50 %.1f us, p99 %.1f us, max %.1f us\n",
+			to_usec(percentile(render_nsec, 0.5)),
+			to_usec(percentile(render_nsec, 0.99)),
+			to_usec(render_nsec.empty() ? 0 : render_nsec.back()));
+	std::printf("deadline misses:  %llu (%.3f%%)\n",
+			static_cast<unsigned long long>(stats.deadline_misses),
+			callbacks == 0 ? 0.0 : 100.0 * stats.deadline_misses / callbacks);
+	std::printf("render lock wait: total %.1f us, p99 %.1f us, max %.1f us\n",
+			to_usec(total_lock_wait),
+			to_usec(percentile(lock_wait_nsec, 0.99)),
+			to_usec(lock_wait_nsec.empty() ? 0 : lock_wait_nsec.back()));
+	std::printf("module lock:      %llu acquisitions, %llu contended, wait total %.1f us, max %.1f us\n",
+			static_cast<unsigned long long>(lock_stats.acquisitions),
+			static_cast<unsigned long long>(lock_stats.contentions),
+			to_usec(lock_stats.wait_nsec),
+			to_usec(lock_stats.max_wait_nsec));
+	std::printf("control calls:    %llu setters, %llu getters, %llu seeks\n",
+			static_cast<unsigned long long>(total_setter_calls),
+			static_cast<unsigned long long>(total_getter_calls),
+			static_cast<unsigned long long>(seek_calls));
+
+	RealtimeViolations violations;
+	if (options.realtime) {
+		uint64_t violating_callbacks = 0;
+		violations = RealtimeChecks::get_totals(violating_callbacks);
+		std::printf("realtime:         %llu callbacks with %llu allocations, %llu lock acquisitions\n",
+				static_cast<unsigned long long>(violating_callbacks),
+				static_cast<unsigned long long>(violations.allocations),
+				static_cast<unsigned long long>(violations.lock_acquisitions));
+	}
+
+	// Non-zero so that scripts can fail on missed deadlines or, with
+	// `--realtime`, on allocations and locks
+	return stats.deadline_misses == 0 && !violations.any() ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+// Renders every module of a corpus with every interpolation filter and reports
+// the render throughput. Used to collect the PGO profile of libopenmpt and to
+// compare the optimized build against the plain one, see `pgo.py`.
+
+#include "load_module.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Interpolation filters as accepted by `OpenMPTModule::set_interpolation_filter`
+constexpr int32_t FILTERS[] = { 1, 2, 4, 8 };
+
+constexpr int32_t BLOCK_FRAMES = 1024;
+
+static void print_usage() {
+	std::fprintf(stderr,
+			"Usage: render_bench [options] <module>...\n"
+			"  --rate=N     Output sampling rate (48000)\n"
+			"  --seconds=N  Seconds rendered per module and filter (20)\n");
+}
+
+int main(int argc, char **argv) {
+	int32_t rate = 48000;
+	double seconds = 20.0;
+	std::vector<const char *> paths;
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (std::strncmp(arg, "--rate=", 7) == 0) {
+			rate = std::atoi(arg + 7);
+		} else if (std::strncmp(arg, "--seconds=", 10) == 0) {
+			seconds = std::atof(arg + 10);
+		} else if (std::strncmp(arg, "--", 2) == 0) {
+			print_usage();
+			return 2;
+		} else {
+			paths.push_back(arg);
+		}
+	}
+	if (paths.empty() || rate <= 0 || seconds <= 0.0) {
+		print_usage();
+		return 2;
+	}
+
+	std::vector<float> buffer(BLOCK_FRAMES * 2);
+	auto frames_per_run = static_cast<uint64_t>(seconds * rate);
+
+	uint64_t total_frames = 0;
+	double total_seconds = 0.0;
+	for (auto path : paths) {
+		std::vector<char> data;
+		OpenMPTModule module;
+		if (!load_module(path, data, module)) {
+			return 2;
+		}
+		module.set_repeat_count(-1);
+
+		for (auto filter : FILTERS) {
+			module.set_position_seconds(0.0);
+			module.set_interpolation_filter(filter);
+
+			auto start = Clock::now();
+			uint64_t frames = 0;
+			while (frames < frames_per_run) {
+				auto rendered = module.read_interleaved_float_stereo(rate, BLOCK_FRAMES, buffer.data());
+				if (rendered == 0) {
+					break;
+				}
+				frames += rendered;
+			}
+			auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+			total_frames += frames;
+			total_seconds += elapsed;
+			std::printf("%s filter=%d: %.0f frames/s\n", path, filter, elapsed > 0.0 ? frames / elapsed : 0.0);
+		}
+	}
+
+	// Parsed by `pgo.py`
+	std::printf("throughput: %.0f frames/s\n", total_seconds > 0.0 ? total_frames / total_seconds : 0.0);
+	return 0;
+}
@@ -0,0 +1,406 @@
+#!/usr/bin/env python
+"""Writes the XM and IT modules of the PGO corpus to `corpus/`.
+
+The demo project only has a MOD file, so these cover the XM and IT loaders
+and the playback code only those formats use: linear slides, envelopes,
+16-bit and ping-pong samples, and new note actions. Both modules play the
+same generated song on synthesized samples, so they can be rebuilt from
+this script instead of being opaque binaries.
+"""
+
+import math
+import os
+import random
+import struct
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+CORPUS_DIR = os.path.join(BENCH_DIR, "corpus")
+
+NUM_CHANNELS = 6
+NUM_ROWS = 64
+ORDERS = [0, 1, 2, 3, 1, 2, 3]
+SPEED = 6
+TEMPO = 125
+
+# Notes are numbered from C-0 = 0
+BASS_LINE = [36, 36, 43, 41, 39, 39, 46, 43]
+CHORDS = [(0x37, 0), (0x47, 0), (0x37, 5), (0x38, 7)]
+MELODY = [60, 63, 65, 67, 70, 67, 65, 63, 62, 63, 65, 70, 72, 70, 67, 65]
+
+# Effects, translated per format
+ARPEGGIO = "arpeggio"
+PORTA_UP = "porta_up"
+TONE_PORTA = "tone_porta"
+VIBRATO = "vibrato"
+VOLUME_SLIDE = "volume_slide"
+
+XM_EFFECTS = {ARPEGGIO: 0x0, PORTA_UP: 0x1, TONE_PORTA: 0x3, VIBRATO: 0x4, VOLUME_SLIDE: 0xA}
+IT_EFFECTS = {ARPEGGIO: 10, PORTA_UP: 6, TONE_PORTA: 7, VIBRATO: 8, VOLUME_SLIDE: 4}
+
+
+class Cell:
+    def __init__(self, note=None, instrument=0, volume=None, effect=None, param=0):
+        self.note = note
+        self.instrument = instrument
+        self.volume = volume
+        self.effect = effect
+        self.param = param
+
+    def is_empty(self):
+        return self.note is None and self.instrument == 0 and self.volume is None and self.effect is None
+
+
+def make_patterns():
+    """Returns the patterns as lists of rows of `NUM_CHANNELS` cells."""
+    rng = random.Random(1234)
+    patterns = []
+    for index in range(4):
+        rows = [[Cell() for _ in range(NUM_CHANNELS)] for _ in range(NUM_ROWS)]
+        for row in range(NUM_ROWS):
+            cells = rows[row]
+
+            # Bass, one note per beat with a slide into every other one
+            if row % 4 == 0:
+                note = BASS_LINE[(row // 8 + index * 2) % len(BASS_LINE)]
+                if row % 16 == 8 and index > 0:
+                    cells[0] = Cell(note, 1, effect=TONE_PORTA, param=0x20)
+                else:
+                    cells[0] = Cell(note, 1, volume=48)
+            elif row % 4 == 2:
+                cells[0] = Cell(effect=VOLUME_SLIDE, param=0x02)
+
+            # Drums with some variation
+            if row % 8 == 0 or (index >= 2 and row % 16 == 14):
+                cells[1] = Cell(48, 3, volume=64)
+            elif row % 8 == 4:
+                cells[1] = Cell(60, 3, volume=40)
+            elif rng.random() < 0.25:
+                cells[1] = Cell(72, 3, volume=16 + rng.randrange(24))
+
+            # Arpeggiated chords
+            if row % 16 == 0:
+                arp, shift = CHORDS[(row // 16 + index) % len(CHORDS)]
+                cells[2] = Cell(48 + shift, 4, volume=36, effect=ARPEGGIO, param=arp)
+            elif row % 16 < 12:
+                arp, _ = CHORDS[(row // 16 + index) % len(CHORDS)]
+                cells[2] = Cell(effect=ARPEGGIO, param=arp)
+            elif row % 16 == 12:
+                cells[2] = Cell(effect=VOLUME_SLIDE, param=0x04)
+
+            # Lead with vibrato, silent in the first pattern
+            if index > 0 and row % 4 == 0:
+                note = MELODY[(row // 4 + index * 3) % len(MELODY)]
+                cells[3] = Cell(note, 2, volume=44)
+            elif index > 0 and row % 4 in (1, 2):
+                cells[3] = Cell(effect=VIBRATO, param=0x46)
+
+            # Pad, long notes that overlap through new note actions in IT
+            if row % 32 == 0:
+                cells[4] = Cell(60 + (index % 2) * 5, 4, volume=24)
+            if row % 32 == 16:
+                cells[5] = Cell(67 - (index % 2) * 2, 4, volume=24)
+
+            # A riser at the end of the last pattern
+            if index == 3 and row == 48:
+                cells[5] = Cell(55, 2, volume=20, effect=PORTA_UP, param=0x04)
+            elif index == 3 and row > 48:
+                cells[5] = Cell(effect=PORTA_UP, param=0x04)
+        patterns.append(rows)
+    return patterns
+
+
+def make_samples():
+    """Returns the samples as dicts with signed sample values."""
+    square = [(40 if (i // 16) % 2 == 0 else -40) for i in range(256)]
+    saw = [int(((i % 64) / 64.0 * 2.0 - 1.0) * 20000) for i in range(512)]
+    rng = random.Random(99)
+    drum = []
+    for i in range(3000):
+        decay = math.exp(-i / 500.0)
+        tone = math.sin(2.0 * math.pi * i * (60.0 - i / 100.0) / 8363.0)
+        drum.append(int(max(-128, min(127, (tone * 0.7 + (rng.random() * 2.0 - 1.0) * 0.3) * decay * 120))))
+    sine = [int(math.sin(2.0 * math.pi * i / 128.0) * 100) for i in range(64)]
+    return [
+        dict(name="square bass", data=square, bits=8, loop=(0, 256), pingpong=False),
+        dict(name="saw lead", data=saw, bits=16, loop=(0, 512), pingpong=False),
+        dict(name="drum", data=drum, bits=8, loop=None, pingpong=False),
+        # Half a sine period played back and forth
+        dict(name="sine pad", data=sine, bits=8, loop=(0, 64), pingpong=True),
+    ]
+
+
+def padded(text, size):
+    return text.encode("ascii")[:size].ljust(size, b"\0")
+
+
+def sample_bytes(sample, delta):
+    values = sample["data"]
+    fmt = "<h" if sample["bits"] == 16 else "<b"
+    mask = 0xFFFF if sample["bits"] == 16 else 0xFF
+    out = bytearray()
+    previous = 0
+    for value in values:
+        stored = (value - previous) & mask if delta else value & mask
+        if sample["bits"] == 16:
+            stored = stored - 0x10000 if stored >= 0x8000 else stored
+        else:
+            stored = stored - 0x100 if stored >= 0x80 else stored
+        out += struct.pack(fmt, stored)
+        previous = value
+    return bytes(out)
+
+
+def write_xm(path, patterns, samples):
+    out = bytearray()
+    out += b"Extended Module: "
+    out += padded("gdmpt pgo corpus", 20)
+    out += b"\x1a"
+    out += padded("make_corpus.py", 20)
+    out += struct.pack("<H", 0x0104)
+    orders = bytes(ORDERS).ljust(256, b"\0")
+    # Linear frequency table
+    out += struct.pack("<IHHHHHHHH", 276, len(ORDERS), 0, NUM_CHANNELS, len(patterns), len(samples), 1, SPEED, TEMPO)
+    out += orders
+
+    for rows in patterns:
+        data = bytearray()
+        for cells in rows:
+            for cell in cells:
+                if cell.is_empty():
+                    data.append(0x80)
+                    continue
+                mask = 0x80
+                fields = bytearray()
+                if cell.note is not None:
+                    # XM notes start at 1 = C-0
+                    mask |= 0x01
+                    fields.append(cell.note + 1)
+                if cell.instrument:
+                    mask |= 0x02
+                    fields.append(cell.instrument)
+                if cell.volume is not None:
+                    mask |= 0x04
+                    fields.append(0x10 + cell.volume)
+                if cell.effect is not None:
+                    mask |= 0x08 | 0x10
+                    fields.append(XM_EFFECTS[cell.effect])
+                    fields.append(cell.param)
+                data.append(mask)
+                data += fields
+        out += struct.pack("<IBHH", 9, 0, NUM_ROWS, len(data))
+        out += data
+
+    for index, sample in enumerate(samples):
+        header = bytearray()
+        header += padded(sample["name"], 22)
+        header += struct.pack("<BH", 0, 1)
+        header += struct.pack("<I", 40)
+        header += bytes(96)
+        # Volume envelope: attack, decay and a sustain point, except for the
+        # drum which keeps playing its sample
+        points = [(0, 0), (2, 64), (12, 40), (80, 0)] if index != 2 else []
+        envelope = bytearray()
+        for x, y in points:
+            envelope += struct.pack("<HH", x, y)
+        header += envelope.ljust(48, b"\0")
+        header += bytes(48)
+        header += struct.pack("<BB", len(points), 0)
+        # Sustain on the third point, no loops
+        header += struct.pack("<BBB", 2, 0, 0)
+        header += struct.pack("<BBB", 0, 0, 0)
+        header += struct.pack("<BB", 0x03 if points else 0, 0)
+        # Auto-vibrato on the pad
+        header += struct.pack("<BBBB", 0, 8, 4, 24) if index == 3 else bytes(4)
+        header += struct.pack("<H", 0x200)
+        header += bytes(22)
+        assert len(header) == 259
+        out += struct.pack("<I", 4 + len(header)) + header
+
+        bytes_per_sample = sample["bits"] // 8
+        length = len(sample["data"]) * bytes_per_sample
+        loop_start, loop_length = 0, 0
+        loop_type = 0
+        if sample["loop"] is not None:
+            loop_start = sample["loop"][0] * bytes_per_sample
+            loop_length = (sample["loop"][1] - sample["loop"][0]) * bytes_per_sample
+            loop_type = 2 if sample["pingpong"] else 1
+        sample_type = loop_type | (0x10 if sample["bits"] == 16 else 0)
+        # The 16-bit saw is one octave above C-4 per period of 64 samples
+        relative_note = 12 if index == 1 else 0
+        out += struct.pack("<IIIBbBBbB", length, loop_start, loop_length, 64, 0, sample_type, 128, relative_note, 0)
+        out += padded(sample["name"], 22)
+        out += sample_bytes(sample, delta=True)
+
+    with open(path, "wb") as file:
+        file.write(out)
+
+
+def it_envelope(points, sustain):
+    data = bytearray()
+    flags = 0
+    if points:
+        flags |= 0x01
+    if sustain is not None:
+        flags |= 0x04
+    sustain = sustain or 0
+    data += struct.pack("<BBBBBB", flags, len(points), 0, 0, sustain, sustain)
+    nodes = bytearray()
+    for tick, value in points:
+        nodes += struct.pack("<bH", value, tick)
+    data += nodes.ljust(75, b"\0")
+    data += b"\0"
+    return bytes(data)
+
+
+def write_it(path, patterns, samples):
+    num_instruments = len(samples)
+    header = bytearray()
+    header += b"IMPM"
+    header += padded("gdmpt pgo corpus", 26)
+    header += struct.pack("<BB", 4, 16)
+    # Orders end with 255
+    header += struct.pack("<HHHH", len(ORDERS) + 1, num_instruments, len(samples), len(patterns))
+    header += struct.pack("<HH", 0x0214, 0x0214)
+    # Stereo, instruments, linear slides
+    header += struct.pack("<HH", 0x01 | 0x04 | 0x08, 0)
+    header += struct.pack("<BBBBBB", 128, 48, SPEED, TEMPO, 128, 0)
+    header += struct.pack("<HII", 0, 0, 0)
+    pans = bytearray()
+    for channel in range(64):
+        if channel < NUM_CHANNELS:
+            pans.append(16 if channel % 2 == 0 else 48)
+        else:
+            # Disabled
+            pans.append(32 | 0x80)
+    header += pans
+    header += bytes([64] * 64)
+    assert len(header) == 192
+
+    orders = bytes(ORDERS) + b"\xff"
+    offsets_start = 192 + len(orders)
+    offsets_size = 4 * (num_instruments + len(samples) + len(patterns))
+    position = offsets_start + offsets_size
+
+    instrument_blocks = []
+    for index, sample in enumerate(samples):
+        block = bytearray()
+        block += b"IMPI"
+        block += padded("", 12)
+        block += b"\0"
+        # The pad fades out in the background when the next note starts,
+        # everything else is cut
+        nna = 3 if index == 3 else 0
+        block += struct.pack("<BBBHbBBBBB", nna, 0, 0, 128, 0, 60, 128, 32 | 0x80, 0, 0)
+        block += struct.pack("<HBB", 0x0214, 1, 0)
+        block += padded(sample["name"], 26)
+        block += struct.pack("<BBBBH", 0, 0, 0, 0, 0)
+        for note in range(120):
+            block += struct.pack("<BB", note, index + 1)
+        if index == 2:
+            block += it_envelope([], None)
+        else:
+            block += it_envelope([(0, 0), (2, 64), (12, 40), (80, 0)], 2)
+        # Panning and pitch envelopes are off
+        block += it_envelope([], None)
+        block += it_envelope([], None)
+        block += bytes(4)
+        assert len(block) == 554
+        instrument_blocks.append(block)
+
+    instrument_offsets = []
+    for block in instrument_blocks:
+        instrument_offsets.append(position)
+        position += len(block)
+
+    sample_offsets = []
+    position_after_headers = position + 80 * len(samples)
+    data_position = position_after_headers
+    sample_blocks = []
+    sample_data = []
+    for index, sample in enumerate(samples):
+        sample_offsets.append(position + 80 * index)
+        flags = 0x01
+        if sample["bits"] == 16:
+            flags |= 0x02
+        if sample["loop"] is not None:
+            flags |= 0x10
+            if sample["pingpong"]:
+                flags |= 0x40
+        block = bytearray()
+        block += b"IMPS"
+        block += padded("", 12)
+        block += b"\0"
+        block += struct.pack("<BBB", 64, flags, 64)
+        block += padded(sample["name"], 26)
+        # Signed samples, default panning unused
+        block += struct.pack("<BB", 0x01, 32)
+        loop_start, loop_end = sample["loop"] if sample["loop"] is not None else (0, 0)
+        # C-5 in IT is C-4 in XM, so the rate is doubled for the same pitch
+        c5_speed = 8363 * 2 * (2 if index == 1 else 1)
+        data = sample_bytes(sample, delta=False)
+        block += struct.pack("<IIIIIII", len(sample["data"]), loop_start, loop_end, c5_speed, 0, 0, data_position)
+        block += struct.pack("<BBBB", 0, 0, 0, 0)
+        assert len(block) == 80
+        sample_blocks.append(block)
+        sample_data.append(data)
+        data_position += len(data)
+    position = data_position
+
+    pattern_offsets = []
+    pattern_blocks = []
+    for rows in patterns:
+        data = bytearray()
+        for cells in rows:
+            for channel, cell in enumerate(cells):
+                if cell.is_empty():
+                    continue
+                mask = 0
+                fields = bytearray()
+                if cell.note is not None:
+                    mask |= 0x01
+                    fields.append(cell.note)
+                if cell.instrument:
+                    mask |= 0x02
+                    fields.append(cell.instrument)
+                if cell.volume is not None:
+                    mask |= 0x04
+                    fields.append(cell.volume)
+                if cell.effect is not None:
+                    mask |= 0x08
+                    fields.append(IT_EFFECTS[cell.effect])
+                    fields.append(cell.param)
+                data.append((channel + 1) | 0x80)
+                data.append(mask)
+                data += fields
+            data.append(0)
+        pattern_offsets.append(position)
+        block = struct.pack("<HH", len(data), NUM_ROWS) + bytes(4) + data
+        pattern_blocks.append(block)
+        position += len(block)
+
+    out = bytearray(header)
+    out += orders
+    for offset in instrument_offsets + sample_offsets + pattern_offsets:
+        out += struct.pack("<I", offset)
+    for block in instrument_blocks + sample_blocks:
+        out += block
+    for data in sample_data:
+        out += data
+    for block in pattern_blocks:
+        out += block
+    assert len(out) == position
+
+    with open(path, "wb") as file:
+        file.write(out)
+
+
+def main():
+    os.makedirs(CORPUS_DIR, exist_ok=True)
+    patterns = make_patterns()
+    samples = make_samples()
+    write_xm(os.path.join(CORPUS_DIR, "pgo_corpus.xm"), patterns, samples)
+    write_it(os.path.join(CORPUS_DIR, "pgo_corpus.it"), patterns, samples)
+
+
+if __name__ == "__main__":
+    main()
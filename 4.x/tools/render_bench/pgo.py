@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+"""Builds libopenmpt with profile-guided optimization and reports the gain.
+
+1. Builds and runs `render_bench` against the plain LTO libopenmpt.
+2. Builds an instrumented libopenmpt and renders the corpus to collect a profile.
+3. Rebuilds libopenmpt with the profile and runs `render_bench` again.
+
+libopenmpt is left built with the profile, so a following
+`scons target=template_release pgo=use` in `4.x` links it without rebuilding.
+Extra arguments are passed to SCons, e.g. `use_llvm=yes`.
+"""
+
+import argparse
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+REPO_DIR = os.path.normpath(os.path.join(BENCH_DIR, "..", "..", ".."))
+# The demo's MOD and the XM and IT modules written by `make_corpus.py`
+DEFAULT_CORPUS = [os.path.join(REPO_DIR, "4.x", "project"), os.path.join(BENCH_DIR, "corpus")]
+MODULE_EXTENSIONS = (".mod", ".s3m", ".xm", ".it", ".mptm", ".669", ".mtm", ".stm", ".okt", ".med", ".far", ".ult")
+
+
+def find_modules(paths):
+    modules = []
+    for path in paths:
+        if os.path.isfile(path):
+            modules.append(os.path.abspath(path))
+            continue
+        for root, _, files in os.walk(path):
+            for name in sorted(files):
+                if name.lower().endswith(MODULE_EXTENSIONS):
+                    modules.append(os.path.join(root, name))
+    return modules
+
+
+def build(pgo, pgo_dir, jobs, scons_args):
+    command = ["scons", "-j{}".format(jobs), "target=template_release", "pgo=" + pgo, "pgo_dir=" + pgo_dir]
+    subprocess.run(command + scons_args, cwd=BENCH_DIR, check=True)
+
+    programs = glob.glob(os.path.join(BENCH_DIR, "bin", "render_bench*"))
+    if len(programs) != 1:
+        sys.exit("Expected a single render_bench program in bin/, found {}".format(programs))
+    return programs[0]
+
+
+def run(program, modules, seconds, env=None):
+    result = subprocess.run(
+        [program, "--seconds={}".format(seconds)] + modules,
+        env=env,
+        check=True,
+        stdout=subprocess.PIPE,
+        universal_newlines=True,
+    )
+    print(result.stdout, end="")
+
+    match = re.search(r"^throughput: (\d+) frames/s$", result.stdout, re.MULTILINE)
+    if match is None:
+        sys.exit("render_bench did not report its throughput")
+    return int(match.group(1))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--corpus", action="append", help="Module file or folder, can be repeated")
+    parser.add_argument("--seconds", type=float, default=20.0, help="Seconds rendered per module and filter")
+    parser.add_argument("--pgo-dir", default=os.path.join(REPO_DIR, "bin", "pgo"), help="Profile directory")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1)
+    args, scons_args = parser.parse_known_args()
+
+    modules = find_modules(args.corpus or DEFAULT_CORPUS)
+    if not modules:
+        sys.exit("No modules found in the corpus")
+    pgo_dir = os.path.abspath(args.pgo_dir)
+
+    print("Plain LTO build")
+    program = build("none", pgo_dir, args.jobs, scons_args)
+    baseline = run(program, modules, args.seconds)
+
+    print("Collecting the profile")
+    shutil.rmtree(pgo_dir, ignore_errors=True)
+    os.makedirs(pgo_dir)
+    program = build("generate", pgo_dir, args.jobs, scons_args)
+    env = dict(os.environ)
+    # Only used by Clang, GCC writes to `pgo_dir` by itself
+    env["LLVM_PROFILE_FILE"] = os.path.join(pgo_dir, "render_bench-%p.profraw")
+    run(program, modules, args.seconds, env)
+
+    raw_profiles = glob.glob(os.path.join(pgo_dir, "*.profraw"))
+    if raw_profiles:
+        merge = ["llvm-profdata", "merge", "-output=" + os.path.join(pgo_dir, "default.profdata")]
+        subprocess.run(merge + raw_profiles, check=True)
+
+    print("PGO build")
+    program = build("use", pgo_dir, args.jobs, scons_args)
+    optimized = run(program, modules, args.seconds)
+
+    print()
+    print("Plain LTO: {} frames/s".format(baseline))
+    print("PGO:       {} frames/s".format(optimized))
+    print("Gain:      {:+.1f}%".format((optimized / baseline - 1.0) * 100.0 if baseline else 0.0))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,235 @@
+#ifndef GDMPT_TRANSCODER_ENCODERS_H
+#define GDMPT_TRANSCODER_ENCODERS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <string>
+
+#ifdef GDMPT_TRANSCODER_VORBIS
+#include <vorbis/vorbisenc.h>
+#endif
+
+// Writes interleaved stereo float frames to a file
+class Encoder {
+public:
+	virtual ~Encoder() = default;
+
+	virtual bool open(const std::string &path, int32_t rate) = 0;
+	virtual bool write(const float *interleaved_stereo, size_t frames) = 0;
+	// Must be called for the file to be complete. Returns `false` if `open`
+	// did not succeed.
+	virtual bool close() = 0;
+};
+
+// RIFF WAVE, 16-bit PCM or 32-bit float
+class WavEncoder : public Encoder {
+	std::FILE *file = nullptr;
+	int32_t bits;
+	uint32_t data_bytes = 0;
+
+	bool write_u16(uint16_t value) {
+		uint8_t bytes[] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8) };
+		return std::fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+	}
+
+	bool write_u32(uint32_t value) {
+		uint8_t bytes[] = {
+			static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+			static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24)
+		};
+		return std::fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+	}
+
+	// The sizes are written again by `close`
+	bool write_header(int32_t rate) {
+		uint16_t format = bits == 32 ? 3 : 1; // IEEE float or PCM
+		uint16_t block_align = 2 * bits / 8;
+		return std::fwrite("RIFF", 1, 4, file) == 4 &&
+				write_u32(36 + data_bytes) &&
+				std::fwrite("WAVEfmt ", 1, 8, file) == 8 &&
+				write_u32(16) &&
+				write_u16(format) &&
+				write_u16(2) &&
+				write_u32(static_cast<uint32_t>(rate)) &&
+				write_u32(static_cast<uint32_t>(rate) * block_align) &&
+				write_u16(block_align) &&
+				write_u16(static_cast<uint16_t>(bits)) &&
+				std::fwrite("data", 1, 4, file) == 4 &&
+				write_u32(data_bytes);
+	}
+
+public:
+	explicit WavEncoder(int32_t p_bits) :
+			bits(p_bits) {}
+
+	~WavEncoder() override {
+		if (file != nullptr) {
+			std::fclose(file);
+		}
+	}
+
+	bool open(const std::string &path, int32_t rate) override {
+		file = std::fopen(path.c_str(), "wb");
+		return file != nullptr && write_header(rate);
+	}
+
+	bool write(const float *interleaved_stereo, size_t frames) override {
+		size_t samples = frames * 2;
+		if (bits == 32) {
+			// Assumes a little-endian host like the rest of the tools
+			data_bytes += static_cast<uint32_t>(samples * sizeof(float));
+			return std::fwrite(interleaved_stereo, sizeof(float), samples, file) == samples;
+		}
+
+		int16_t block[1024];
+		for (size_t offset = 0; offset < samples; offset += std::size(block)) {
+			size_t count = std::min(samples - offset, std::size(block));
+			for (size_t i = 0; i < count; i++) {
+				float sample = std::clamp(interleaved_stereo[offset + i], -1.0f, 1.0f);
+				block[i] = static_cast<int16_t>(std::lround(sample * 32767.0f));
+			}
+			if (std::fwrite(block, sizeof(int16_t), count, file) != count) {
+				return false;
+			}
+		}
+		data_bytes += static_cast<uint32_t>(samples * sizeof(int16_t));
+		return true;
+	}
+
+	bool close() override {
+		if (file == nullptr) {
+			return false;
+		}
+		// RIFF and data chunk sizes
+		bool ok = std::fseek(file, 4, SEEK_SET) == 0 && write_u32(36 + data_bytes);
+		ok = ok && std::fseek(file, 40, SEEK_SET) == 0 && write_u32(data_bytes);
+		ok = std::fclose(file) == 0 && ok;
+		file = nullptr;
+		return ok;
+	}
+};
+
+#ifdef GDMPT_TRANSCODER_VORBIS
+// Ogg Vorbis through libvorbisenc in VBR mode
+class VorbisEncoder : public Encoder {
+	std::FILE *file = nullptr;
+	float quality;
+	bool initialized = false;
+
+	vorbis_info info;
+	vorbis_comment comment;
+	vorbis_dsp_state dsp;
+	vorbis_block block;
+	ogg_stream_state stream;
+
+	bool write_page(const ogg_page &page) {
+		return std::fwrite(page.header, 1, page.header_len, file) == static_cast<size_t>(page.header_len) &&
+				std::fwrite(page.body, 1, page.body_len, file) == static_cast<size_t>(page.body_len);
+	}
+
+	// Encodes what was submitted to `dsp` and writes the finished pages
+	bool drain() {
+		ogg_packet packet;
+		ogg_page page;
+		while (vorbis_analysis_blockout(&dsp, &block) == 1) {
+			vorbis_analysis(&block, nullptr);
+			vorbis_bitrate_addblock(&block);
+			while (vorbis_bitrate_flushpacket(&dsp, &packet)) {
+				ogg_stream_packetin(&stream, &packet);
+				while (ogg_stream_pageout(&stream, &page)) {
+					if (!write_page(page)) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+public:
+	explicit VorbisEncoder(float p_quality) :
+			quality(p_quality) {}
+
+	~VorbisEncoder() override {
+		if (initialized) {
+			ogg_stream_clear(&stream);
+			vorbis_block_clear(&block);
+			vorbis_dsp_clear(&dsp);
+			vorbis_comment_clear(&comment);
+			vorbis_info_clear(&info);
+		}
+		if (file != nullptr) {
+			std::fclose(file);
+		}
+	}
+
+	bool open(const std::string &path, int32_t rate) override {
+		file = std::fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			return false;
+		}
+
+		vorbis_info_init(&info);
+		if (vorbis_encode_init_vbr(&info, 2, rate, quality) != 0) {
+			vorbis_info_clear(&info);
+			return false;
+		}
+		vorbis_comment_init(&comment);
+		vorbis_comment_add_tag(&comment, "ENCODER", "gdmpt transcoder");
+		vorbis_analysis_init(&dsp, &info);
+		vorbis_block_init(&dsp, &block);
+		ogg_stream_init(&stream, static_cast<int>(std::hash<std::string>()(path)));
+		initialized = true;
+
+		ogg_packet header;
+		ogg_packet header_comment;
+		ogg_packet header_code;
+		vorbis_analysis_headerout(&dsp, &comment, &header, &header_comment, &header_code);
+		ogg_stream_packetin(&stream, &header);
+		ogg_stream_packetin(&stream, &header_comment);
+		ogg_stream_packetin(&stream, &header_code);
+
+		// The audio has to start on a new page
+		ogg_page page;
+		while (ogg_stream_flush(&stream, &page)) {
+			if (!write_page(page)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool write(const float *interleaved_stereo, size_t frames) override {
+		float **buffer = vorbis_analysis_buffer(&dsp, static_cast<int>(frames));
+		for (size_t i = 0; i < frames; i++) {
+			buffer[0][i] = interleaved_stereo[2 * i];
+			buffer[1][i] = interleaved_stereo[2 * i + 1];
+		}
+		vorbis_analysis_wrote(&dsp, static_cast<int>(frames));
+		return drain();
+	}
+
+	bool close() override {
+		if (!initialized) {
+			return false;
+		}
+		// Marks the end of the stream
+		vorbis_analysis_wrote(&dsp, 0);
+		bool ok = drain();
+
+		ogg_page page;
+		while (ok && ogg_stream_flush(&stream, &page)) {
+			ok = write_page(page);
+		}
+		ok = std::fclose(file) == 0 && ok;
+		file = nullptr;
+		return ok;
+	}
+};
+#endif
+
+#endif
@@ -0,0 +1,405 @@
+// Renders a list of modules to WAV or Ogg Vorbis files on every core, for
+// platforms that play pre-rendered fallbacks instead of running the mixer.
+// Outputs whose module and render settings did not change are skipped.
+
+#include "content_hash.h"
+#include "encoders.h"
+#include "load_module.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int32_t BLOCK_FRAMES = 1024;
+
+struct Options {
+	std::vector<std::string> paths;
+	std::string out_dir = ".";
+	std::string format = "wav";
+	int32_t rate = 48000;
+	// 0 keeps libopenmpt's default
+	int32_t filter = 0;
+	int32_t loops = 1;
+	double fade = 0.0;
+	int32_t bits = 16;
+	double quality = 0.5;
+	int32_t jobs = static_cast<int32_t>(std::max(std::thread::hardware_concurrency(), 1u));
+	bool force = false;
+};
+
+enum class Result {
+	RENDERED,
+	UP_TO_DATE,
+	FAILED
+};
+
+static void print_usage() {
+	std::fprintf(stderr,
+			"Usage: transcoder [options] <module>...\n"
+			"  --list=PATH     File with one module path per line\n"
+			"  --out-dir=PATH  Output folder, mirroring the folders of the modules (.)\n"
+			"  --format=F      wav or ogg (wav)\n"
+			"  --rate=N        Output sampling rate (48000)\n"
+			"  --filter=N      Interpolation filter: 1, 2, 4 or 8, 0 for libopenmpt's default (0)\n"
+			"  --loops=N       Times the song is played (1)\n"
+			"  --fade=N        Seconds faded out after the last loop, played from the song's start (0)\n"
+			"  --bits=N        WAV sample format: 16 for PCM, 32 for float (16)\n"
+			"  --quality=N     Ogg Vorbis VBR quality from -0.1 to 1 (0.5)\n"
+			"  --jobs=N        Files rendered in parallel (number of cores)\n"
+			"  --force         Render even if the output is up to date\n");
+}
+
+static bool read_list(const char *path, std::vector<std::string> &paths) {
+	std::ifstream file(path);
+	if (!file) {
+		std::fprintf(stderr, "Cannot open '%s'\n", path);
+		return false;
+	}
+	std::string line;
+	while (std::getline(file, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (!line.empty() && line[0] != '#') {
+			paths.push_back(line);
+		}
+	}
+	return true;
+}
+
+static bool parse_options(int argc, char **argv, Options &options) {
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (std::strncmp(arg, "--", 2) != 0) {
+			options.paths.push_back(arg);
+			continue;
+		}
+		if (std::strcmp(arg, "--force") == 0) {
+			options.force = true;
+			continue;
+		}
+
+		const char *value = std::strchr(arg, '=');
+		if (value == nullptr) {
+			return false;
+		}
+		std::string name(arg + 2, value - arg - 2);
+		value++;
+
+		if (name == "list") {
+			if (!read_list(value, options.paths)) {
+				return false;
+			}
+		} else if (name == "out-dir") {
+			options.out_dir = value;
+		} else if (name == "format") {
+			options.format = value;
+		} else if (name == "rate") {
+			options.rate = std::atoi(value);
+		} else if (name == "filter") {
+			options.filter = std::atoi(value);
+		} else if (name == "loops") {
+			options.loops = std::atoi(value);
+		} else if (name == "fade") {
+			options.fade = std::atof(value);
+		} else if (name == "bits") {
+			options.bits = std::atoi(value);
+		} else if (name == "quality") {
+			options.quality = std::atof(value);
+		} else if (name == "jobs") {
+			options.jobs = std::atoi(value);
+		} else {
+			return false;
+		}
+	}
+
+#ifndef GDMPT_TRANSCODER_VORBIS
+	if (options.format == "ogg") {
+		std::fprintf(stderr, "Ogg Vorbis output needs a build with `scons vorbis=yes`\n");
+		return false;
+	}
+#endif
+	return !options.paths.empty() &&
+			(options.format == "wav" || options.format == "ogg") &&
+			(options.bits == 16 || options.bits == 32) &&
+			options.rate >= 8000 && options.rate <= 192000 &&
+			options.loops >= 1 && options.fade >= 0.0 && options.jobs >= 1;
+}
+
+// Hash of the module and of every setting that changes the output, stored
+// next to the output to find out whether it is up to date
+static std::string get_render_key(const std::vector<char> &data, const Options &options) {
+	char settings[256];
+	std::snprintf(settings, sizeof(settings), "%s rate=%d filter=%d loops=%d fade=%g bits=%d quality=%g",
+			options.format.c_str(), options.rate, options.filter, options.loops, options.fade,
+			options.format == "wav" ? options.bits : 0, options.format == "ogg" ? options.quality : 0.0);
+
+	char key[64];
+	std::snprintf(key, sizeof(key), "%016" PRIx64 "-%016" PRIx64,
+			hash_content(data.data(), data.size()),
+			hash_content(settings, std::strlen(settings)));
+	return key;
+}
+
+static std::string read_key_file(const fs::path &path) {
+	std::ifstream file(path);
+	std::string key;
+	std::getline(file, key);
+	return key;
+}
+
+static std::unique_ptr<Encoder> create_encoder(const Options &options) {
+#ifdef GDMPT_TRANSCODER_VORBIS
+	if (options.format == "ogg") {
+		return std::make_unique<VorbisEncoder>(static_cast<float>(options.quality));
+	}
+#endif
+	return std::make_unique<WavEncoder>(options.bits);
+}
+
+// Renders `options.loops` plays of the song followed by the fade-out
+static bool render(OpenMPTModule &module, const Options &options, Encoder &encoder) {
+	if (options.filter != 0) {
+		module.set_interpolation_filter(options.filter);
+	}
+	// The fade-out continues into another play of the song
+	module.set_repeat_count(options.fade > 0.0 ? options.loops : options.loops - 1);
+
+	auto song_frames = static_cast<uint64_t>(module.get_duration_seconds() * options.rate * options.loops);
+	auto fade_frames = static_cast<uint64_t>(options.fade * options.rate);
+	auto total_frames = song_frames + fade_frames;
+
+	std::vector<float> buffer(BLOCK_FRAMES * 2);
+	uint64_t frames = 0;
+	while (frames < total_frames) {
+		auto count = static_cast<size_t>(std::min<uint64_t>(BLOCK_FRAMES, total_frames - frames));
+		auto rendered = module.read_interleaved_float_stereo(options.rate, count, buffer.data());
+		if (rendered == 0) {
+			break;
+		}
+
+		for (size_t i = 0; i < rendered; i++) {
+			auto frame = frames + i;
+			if (frame >= song_frames) {
+				auto gain = 1.0f - static_cast<float>(frame - song_frames) / fade_frames;
+				buffer[2 * i] *= gain;
+				buffer[2 * i + 1] *= gain;
+			}
+		}
+		if (!encoder.write(buffer.data(), rendered)) {
+			return false;
+		}
+		frames += rendered;
+	}
+	return true;
+}
+
+// Output paths without extension. The inputs' folders are mirrored below the
+// output folder, starting from the folder that contains all of them. Fails if
+// two inputs still map to the same output, e.g. `theme.mod` and `theme.xm`.
+static bool get_output_stems(const Options &options, std::vector<fs::path> &stems) {
+	std::vector<fs::path> inputs;
+	for (const auto &path : options.paths) {
+		inputs.push_back(fs::absolute(path).lexically_normal());
+	}
+
+	auto base = inputs[0].parent_path();
+	for (const auto &input : inputs) {
+		auto parent = input.parent_path();
+		fs::path common;
+		auto a = base.begin();
+		auto b = parent.begin();
+		for (; a != base.end() && b != parent.end() && *a == *b; ++a, ++b) {
+			common /= *a;
+		}
+		base = common;
+	}
+
+	std::map<fs::path, size_t> outputs;
+	for (size_t i = 0; i < inputs.size(); i++) {
+		auto relative = inputs[i].parent_path().lexically_relative(base) / inputs[i].stem();
+		auto stem = (fs::path(options.out_dir) / relative).lexically_normal();
+
+		auto inserted = outputs.emplace(stem, i);
+		if (!inserted.second) {
+			std::fprintf(stderr, "'%s' and '%s' would both be written to '%s'\n",
+					options.paths[inserted.first->second].c_str(), options.paths[i].c_str(), stem.string().c_str());
+			return false;
+		}
+		stems.push_back(stem);
+	}
+	return true;
+}
+
+static Result transcode(const std::string &path, const fs::path &stem, const Options &options) {
+	auto out_path = stem;
+	out_path += "." + options.format;
+	auto key_path = out_path;
+	key_path += ".hash";
+
+	std::vector<char> data;
+	if (!read_module_file(path.c_str(), data)) {
+		return Result::FAILED;
+	}
+	auto key = get_render_key(data, options);
+	if (!options.force && fs::exists(out_path) && read_key_file(key_path) == key) {
+		return Result::UP_TO_DATE;
+	}
+
+	OpenMPTModule module;
+	if (!create_module(path.c_str(), data, module)) {
+		return Result::FAILED;
+	}
+
+	std::error_code error;
+	fs::create_directories(out_path.parent_path(), error);
+
+	// Rendered to a temporary file so that an interrupted run never leaves an
+	// output that looks complete
+	auto temp_path = out_path;
+	temp_path += ".tmp";
+	auto encoder = create_encoder(options);
+	bool ok = encoder->open(temp_path.string(), options.rate);
+	if (ok) {
+		ok = render(module, options, *encoder);
+		ok = encoder->close() && ok;
+	}
+	encoder.reset();
+
+	if (ok) {
+		fs::rename(temp_path, out_path, error);
+	}
+	if (!ok || error) {
+		std::fprintf(stderr, "Cannot write '%s'\n", out_path.string().c_str());
+		fs::remove(temp_path, error);
+		return Result::FAILED;
+	}
+
+	std::ofstream key_file(key_path);
+	key_file << key << '\n';
+	return Result::RENDERED;
+}
+
+// Every worker starts with its share of the files and takes files from the
+// others once it runs out, so a few long modules do not leave cores idle
+class WorkStealingQueue {
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<WorkerQueue> queues;
+
+public:
+	WorkStealingQueue(size_t workers, size_t tasks) :
+			queues(workers) {
+		for (size_t i = 0; i < tasks; i++) {
+			queues[i % workers].tasks.push_back(i);
+		}
+	}
+
+	// Returns `false` once every queue is empty. Tasks never add tasks, so
+	// there is nothing to wait for at that point.
+	bool pop(size_t worker, size_t &task) {
+		for (size_t i = 0; i < queues.size(); i++) {
+			auto &queue = queues[(worker + i) % queues.size()];
+			const std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty()) {
+				continue;
+			}
+			// Takes its own tasks in order and steals from the other end
+			if (i == 0) {
+				task = queue.tasks.front();
+				queue.tasks.pop_front();
+			} else {
+				task = queue.tasks.back();
+				queue.tasks.pop_back();
+			}
+			return true;
+		}
+		return false;
+	}
+};
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!parse_options(argc, argv, options)) {
+		print_usage();
+		return 2;
+	}
+
+	std::error_code error;
+	fs::create_directories(options.out_dir, error);
+	if (error) {
+		std::fprintf(stderr, "Cannot create '%s'\n", options.out_dir.c_str());
+		return 2;
+	}
+	std::vector<fs::path> stems;
+	if (!get_output_stems(options, stems)) {
+		return 2;
+	}
+
+	auto workers = std::min(static_cast<size_t>(options.jobs), options.paths.size());
+	WorkStealingQueue queue(workers, options.paths.size());
+	std::atomic<size_t> rendered{ 0 };
+	std::atomic<size_t> up_to_date{ 0 };
+	std::atomic<size_t> failed{ 0 };
+	std::mutex print_mutex;
+
+	auto start = Clock::now();
+	std::vector<std::thread> threads;
+	for (size_t worker = 0; worker < workers; worker++) {
+		threads.emplace_back([&, worker]() {
+			size_t task;
+			while (queue.pop(worker, task)) {
+				const auto &path = options.paths[task];
+				auto file_start = Clock::now();
+				auto result = transcode(path, stems[task], options);
+				auto seconds = std::chrono::duration<double>(Clock::now() - file_start).count();
+
+				const char *status = "failed";
+				switch (result) {
+					case Result::RENDERED:
+						rendered++;
+						status = "rendered";
+						break;
+					case Result::UP_TO_DATE:
+						up_to_date++;
+						status = "up to date";
+						break;
+					case Result::FAILED:
+						failed++;
+						break;
+				}
+
+				const std::lock_guard<std::mutex> lock(print_mutex);
+				std::printf("%-10s %s (%.2f s)\n", status, path.c_str(), seconds);
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	std::printf("%zu rendered, %zu up to date, %zu failed in %.2f s on %zu threads\n",
+			rendered.load(), up_to_date.load(), failed.load(),
+			std::chrono::duration<double>(Clock::now() - start).count(), workers);
+	return failed == 0 ? 0 : 1;
+}